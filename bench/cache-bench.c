@@ -0,0 +1,235 @@
+/*
+ * cache-bench.c
+ * microbenchmark for the package cache
+ *
+ * Copyright (c) 2026 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+/*
+ * Fills a client's package cache with synthetic packages, looks every one of
+ * them up, removes them in a shuffled order, fills the cache again and tears it
+ * down with pkgconf_cache_free(), timing each phase.  Finally the cache is filled
+ * once more with a bound of a quarter of the packages, which has to evict the
+ * rest.
+ *
+ * usage: cache-bench [packages]
+ */
+#include "libpkgconf/config.h"
+#include <libpkgconf/stdinc.h>
+#include <libpkgconf/libpkgconf.h>
+
+#include <time.h>
+
+static double
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void
+bench_report(const char *phase, size_t count, double start)
+{
+	double elapsed = bench_now() - start;
+
+	printf("%-10s %9.3f ms  %8.1f ns/package\n", phase, elapsed, count ? elapsed * 1e6 / count : 0.0);
+}
+
+static pkgconf_pkg_t **
+bench_make_packages(pkgconf_client_t *client, size_t count)
+{
+	pkgconf_pkg_t **pkgs = calloc(count, sizeof(pkgconf_pkg_t *));
+	char idbuf[64];
+	size_t i;
+
+	if (pkgs == NULL)
+		return NULL;
+
+	for (i = 0; i < count; i++)
+	{
+		pkgs[i] = calloc(1, sizeof(pkgconf_pkg_t));
+		if (pkgs[i] == NULL)
+			return NULL;
+
+		snprintf(idbuf, sizeof idbuf, "module-" SIZE_FMT_SPECIFIER "-1.0", i);
+
+		pkgs[i]->id = strdup(idbuf);
+		pkgs[i]->owner = client;
+	}
+
+	return pkgs;
+}
+
+/* the cache holds the only reference to each package, so removing one frees it */
+static bool
+bench_fill(pkgconf_client_t *client, size_t count)
+{
+	pkgconf_pkg_t **pkgs = bench_make_packages(client, count);
+	double start;
+	size_t i;
+
+	if (pkgs == NULL)
+		return false;
+
+	start = bench_now();
+
+	for (i = 0; i < count; i++)
+		pkgconf_cache_add(client, pkgs[i]);
+
+	bench_report("add", count, start);
+
+	free(pkgs);
+	return true;
+}
+
+static bool
+bench_lookup(pkgconf_client_t *client, size_t count)
+{
+	char idbuf[64];
+	double start = bench_now();
+	size_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		pkgconf_pkg_t *pkg;
+
+		snprintf(idbuf, sizeof idbuf, "module-" SIZE_FMT_SPECIFIER "-1.0", i);
+
+		if ((pkg = pkgconf_cache_lookup(client, idbuf)) == NULL)
+		{
+			fprintf(stderr, "lookup of %s failed\n", idbuf);
+			return false;
+		}
+
+		pkgconf_pkg_unref(client, pkg);
+	}
+
+	bench_report("lookup", count, start);
+	return true;
+}
+
+static bool
+bench_remove(pkgconf_client_t *client, size_t count)
+{
+	pkgconf_pkg_t **pkgs = calloc(count, sizeof(pkgconf_pkg_t *));
+	char idbuf[64];
+	double start;
+	size_t i;
+
+	if (pkgs == NULL)
+		return false;
+
+	for (i = 0; i < count; i++)
+	{
+		snprintf(idbuf, sizeof idbuf, "module-" SIZE_FMT_SPECIFIER "-1.0", i);
+
+		pkgs[i] = pkgconf_cache_lookup(client, idbuf);
+		pkgconf_pkg_unref(client, pkgs[i]);
+	}
+
+	/* remove in a fixed pseudo-random order */
+	srand(1);
+	for (i = count; i > 1; i--)
+	{
+		size_t j = (size_t) rand() % i;
+		pkgconf_pkg_t *tmp = pkgs[i - 1];
+
+		pkgs[i - 1] = pkgs[j];
+		pkgs[j] = tmp;
+	}
+
+	start = bench_now();
+
+	for (i = 0; i < count; i++)
+		pkgconf_cache_remove(client, pkgs[i]);
+
+	bench_report("remove", count, start);
+
+	free(pkgs);
+
+	if (pkgconf_cache_lookup(client, "module-0-1.0") != NULL)
+	{
+		fprintf(stderr, "cache not empty after removal\n");
+		return false;
+	}
+
+	return true;
+}
+
+static void
+bench_free(pkgconf_client_t *client, size_t count)
+{
+	size_t entries, bytes = pkgconf_cache_get_memory(client, &entries);
+	double start = bench_now();
+
+	printf("%-10s " SIZE_FMT_SPECIFIER " packages, " SIZE_FMT_SPECIFIER " bytes\n", "memory", entries, bytes);
+
+	pkgconf_cache_free(client);
+
+	bench_report("free", count, start);
+}
+
+static bool
+bench_bounded(pkgconf_client_t *client, size_t count)
+{
+	size_t entries, bytes;
+
+	pkgconf_cache_set_limits(client, count / 4, 0);
+
+	if (!bench_fill(client, count))
+		return false;
+
+	bytes = pkgconf_cache_get_memory(client, &entries);
+	printf("%-10s " SIZE_FMT_SPECIFIER " packages, " SIZE_FMT_SPECIFIER " bytes\n", "bounded", entries, bytes);
+
+	if (entries != count / 4)
+	{
+		fprintf(stderr, "bounded cache holds " SIZE_FMT_SPECIFIER " packages\n", entries);
+		return false;
+	}
+
+	pkgconf_cache_free(client);
+	return true;
+}
+
+int
+main(int argc, char *argv[])
+{
+	pkgconf_client_t *client;
+	pkgconf_cross_personality_t *personality = pkgconf_cross_personality_default();
+	size_t count = 5000;
+	bool ok;
+
+	if (argc > 1)
+		count = strtoul(argv[1], NULL, 10);
+
+	client = pkgconf_client_new(NULL, NULL, personality);
+	if (client == NULL)
+		return EXIT_FAILURE;
+
+	printf("package cache, " SIZE_FMT_SPECIFIER " packages\n", count);
+
+	ok = bench_fill(client, count) && bench_lookup(client, count) && bench_remove(client, count) &&
+		bench_fill(client, count);
+
+	if (ok)
+	{
+		bench_free(client, count);
+		ok = bench_bounded(client, count);
+	}
+
+	pkgconf_client_free(client);
+	pkgconf_cross_personality_deinit(personality);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,461 @@
+/*
+ * parser-bench.c
+ * microbenchmark for the .pc file parser
+ *
+ * Copyright (c) 2026 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+/*
+ * The scanners are private to the parser, so the parser is built into the
+ * benchmark directly.  Every available scanner is run over the same inputs,
+ * checked against the scalar one, and timed.  The line-at-a-time parser which
+ * pkgconf_parser_parse() used before it read whole files is kept below as the
+ * baseline, and is timed on a memory stream along with the current
+ * pkgconf_parser_parse(), so that both pay for stdio.
+ *
+ * usage: parser-bench [file.pc ...]
+ */
+#include "../libpkgconf/parser.c"
+
+#include <time.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# include <x86intrin.h>
+# define BENCH_HAVE_TSC
+#endif
+
+typedef struct {
+	const char *name;
+	parser_scan_func_t scan;
+} bench_scanner_t;
+
+typedef struct {
+	const char *name;
+	char *buf;
+	size_t len;
+} bench_input_t;
+
+typedef struct {
+	uint64_t hash;
+	size_t lines;
+} bench_result_t;
+
+static void
+bench_hash_str(bench_result_t *res, const char *str)
+{
+	for (; *str; str++)
+		res->hash = (res->hash ^ (unsigned char) *str) * 1099511628211ULL;
+
+	res->hash = (res->hash ^ 0xff) * 1099511628211ULL;
+}
+
+static void
+bench_operand(void *data, const size_t lineno, const char *key, const char *value)
+{
+	bench_result_t *res = data;
+
+	(void) lineno;
+
+	res->lines++;
+	bench_hash_str(res, key);
+	bench_hash_str(res, value);
+}
+
+static void
+bench_warn(void *data, const char *fmt, ...)
+{
+	(void) data;
+	(void) fmt;
+}
+
+static void
+bench_count(void *data, const size_t lineno, const char *key, const char *value)
+{
+	bench_result_t *res = data;
+
+	(void) lineno;
+	(void) key;
+	(void) value;
+
+	res->lines++;
+}
+
+static pkgconf_parser_operand_func_t bench_verify_ops[256] = {
+	[':'] = bench_operand,
+	['='] = bench_operand,
+};
+
+static pkgconf_parser_operand_func_t bench_timing_ops[256] = {
+	[':'] = bench_count,
+	['='] = bench_count,
+};
+
+/* pkgconf_parser_parse() as it was when it read a line at a time with pkgconf_fgetline() */
+static void
+bench_parse_getc(FILE *f, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename)
+{
+	char readbuf[PKGCONF_BUFSIZE];
+	size_t lineno = 0;
+
+	while (pkgconf_fgetline(readbuf, PKGCONF_BUFSIZE, f) != NULL)
+	{
+		char op, *p, *key, *value;
+		bool warned_key_whitespace = false, warned_value_whitespace = false;
+
+		lineno++;
+
+		p = readbuf;
+		while (*p && isspace((unsigned char)*p))
+			p++;
+		if (*p && p != readbuf)
+		{
+			warnfunc(data, "%s:" SIZE_FMT_SPECIFIER ": warning: whitespace encountered while parsing key section\n",
+				filename, lineno);
+			warned_key_whitespace = true;
+		}
+		key = p;
+		while (*p && (isalpha((unsigned char)*p) || isdigit((unsigned char)*p) || *p == '_' || *p == '.'))
+			p++;
+
+		if (!isalpha((unsigned char)*key) &&
+		    !isdigit((unsigned char)*p))
+			continue;
+
+		while (*p && isspace((unsigned char)*p))
+		{
+			if (!warned_key_whitespace)
+			{
+				warnfunc(data, "%s:" SIZE_FMT_SPECIFIER ": warning: whitespace encountered while parsing key section\n",
+					filename, lineno);
+				warned_key_whitespace = true;
+			}
+
+			/* set to null to avoid trailing spaces in key */
+			*p = '\0';
+			p++;
+		}
+
+		op = *p;
+		if (*p != '\0')
+		{
+			*p = '\0';
+			p++;
+		}
+
+		while (*p && isspace((unsigned char)*p))
+			p++;
+
+		value = p;
+		p = value + (strlen(value) - 1);
+		while (*p && isspace((unsigned char) *p) && p > value)
+		{
+			if (!warned_value_whitespace && op == '=')
+			{
+				warnfunc(data, "%s:" SIZE_FMT_SPECIFIER ": warning: trailing whitespace encountered while parsing value section\n",
+					filename, lineno);
+				warned_value_whitespace = true;
+			}
+
+			*p = '\0';
+			p--;
+		}
+		if (ops[(unsigned char) op])
+			ops[(unsigned char) op](data, lineno, key, value);
+	}
+
+	fclose(f);
+}
+
+static uint64_t
+bench_now(void)
+{
+#ifdef BENCH_HAVE_TSC
+	return __rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+typedef void (*bench_stream_func_t)(FILE *f, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename);
+
+typedef struct {
+	const char *name;
+	bench_stream_func_t parse;
+} bench_stream_t;
+
+static const bench_stream_t bench_streams[] = {
+	{ "getc", bench_parse_getc },
+	{ "stdio", pkgconf_parser_parse },
+};
+
+static bench_result_t
+bench_parse_stream(bench_stream_func_t parse, const bench_input_t *in, const pkgconf_parser_operand_func_t *ops)
+{
+	bench_result_t res = { 14695981039346656037ULL, 0 };
+	FILE *f = fmemopen(in->buf, in->len, "r");
+
+	if (f == NULL)
+	{
+		perror("fmemopen");
+		exit(EXIT_FAILURE);
+	}
+
+	parse(f, &res, ops, bench_warn, in->name);
+	return res;
+}
+
+static bench_result_t
+bench_parse(parser_scan_func_t scan, const bench_input_t *in, const pkgconf_parser_operand_func_t *ops)
+{
+	bench_result_t res = { 14695981039346656037ULL, 0 };
+
+	parser_parse_buffer(scan, in->buf, in->len, &res, ops, bench_warn, in->name);
+	return res;
+}
+
+static void
+bench_append(char **buf, size_t *len, size_t *size, const char *str)
+{
+	size_t slen = strlen(str);
+
+	while (*len + slen + 1 > *size)
+	{
+		*size *= 2;
+		*buf = realloc(*buf, *size);
+	}
+
+	memcpy(*buf + *len, str, slen + 1);
+	*len += slen;
+}
+
+/* a small ordinary package */
+static bench_input_t
+bench_make_small(void)
+{
+	bench_input_t in = { "small", NULL, 0 };
+	size_t size = 64;
+
+	in.buf = malloc(size);
+	bench_append(&in.buf, &in.len, &size,
+		"# generated by the build system\n"
+		"prefix=/usr\n"
+		"exec_prefix=${prefix}\n"
+		"libdir=${exec_prefix}/lib/x86_64-linux-gnu\n"
+		"includedir=${prefix}/include\n"
+		"\n"
+		"Name: foo\n"
+		"Description: A library which does foo things\n"
+		"URL: https://example.org/foo\n"
+		"Version: 1.2.3\n"
+		"Requires: bar >= 2.0, baz\n"
+		"Requires.private: zlib\n"
+		"Libs: -L${libdir} -lfoo\n"
+		"Libs.private: -lm -lpthread\n"
+		"Cflags: -I${includedir}/foo -DFOO_SHARED\r\n");
+
+	return in;
+}
+
+/* a metapackage with multi-kilobyte Requires and Libs lines */
+static bench_input_t
+bench_make_meta(void)
+{
+	static const char *modules[] = {
+		"Core", "Gui", "Widgets", "Network", "Sql", "Xml", "Concurrent", "DBus",
+		"OpenGL", "PrintSupport", "Svg", "Test", "Qml", "Quick", "Multimedia", "WebSockets",
+	};
+	bench_input_t in = { "meta", NULL, 0 };
+	size_t size = 4096;
+	char tmp[256];
+	int i, j;
+
+	in.buf = malloc(size);
+	bench_append(&in.buf, &in.len, &size,
+		"prefix=/opt/qt6\nlibdir=${prefix}/lib\nincludedir=${prefix}/include\n\n"
+		"Name: Qt6All\nDescription: every Qt module\nVersion: 6.7.0\nRequires:");
+	for (j = 0; j < 16; j++)
+		for (i = 0; i < 16; i++)
+		{
+			snprintf(tmp, sizeof tmp, " Qt6%s%d >= 6.7.0,", modules[i], j);
+			bench_append(&in.buf, &in.len, &size, tmp);
+		}
+	bench_append(&in.buf, &in.len, &size, "\nLibs: -L${libdir}");
+	for (j = 0; j < 64; j++)
+	{
+		for (i = 0; i < 16; i++)
+		{
+			snprintf(tmp, sizeof tmp, " -lQt6%s%d -Wl,-rpath,/opt/qt6/lib/%s", modules[i], j, modules[i]);
+			bench_append(&in.buf, &in.len, &size, tmp);
+		}
+		bench_append(&in.buf, &in.len, &size, " \\\n\t");
+	}
+	bench_append(&in.buf, &in.len, &size, "\nCflags: -I${includedir}");
+	for (i = 0; i < 16; i++)
+	{
+		snprintf(tmp, sizeof tmp, " -I${includedir}/Qt%s -DQT_%s_LIB", modules[i], modules[i]);
+		bench_append(&in.buf, &in.len, &size, tmp);
+	}
+	bench_append(&in.buf, &in.len, &size, "\n");
+
+	return in;
+}
+
+static const bench_scanner_t bench_scanners[] = {
+	{ "scalar", parser_scan_scalar },
+#ifdef PKGCONF_PARSER_SSE2
+	{ "sse2", parser_scan_sse2 },
+#endif
+#ifdef PKGCONF_PARSER_AVX2
+	{ "avx2", parser_scan_avx2 },
+#endif
+};
+
+static bool
+bench_scanner_usable(const bench_scanner_t *scanner)
+{
+#ifdef PKGCONF_PARSER_AVX2
+	if (scanner->scan == parser_scan_avx2)
+		return parser_have_avx2;
+#endif
+	(void) scanner;
+	return true;
+}
+
+/* print the rate of a timed parser, relative to the baseline if it has been timed */
+static double
+bench_report(const char *name, const bench_input_t *in, size_t iters, uint64_t elapsed, double base_rate)
+{
+	double rate = (double) in->len * iters / (elapsed ? elapsed : 1);
+
+#ifdef BENCH_HAVE_TSC
+	printf("  %-8s %8.3f bytes/cycle", name, rate);
+#else
+	printf("  %-8s %8.3f bytes/ns", name, rate);
+#endif
+	printf("  (%.2fx)\n", base_rate > 0 ? rate / base_rate : 1.0);
+
+	return rate;
+}
+
+static bool
+bench_run(const bench_input_t *in)
+{
+	size_t i, iters = 1 + (size_t) (64 * 1024 * 1024) / (in->len + 1);
+	bench_result_t ref = bench_parse(parser_scan_scalar, in, bench_verify_ops);
+	double base_rate = 0;
+	bool ok = true;
+
+	printf("%s: %zu bytes, %zu fields\n", in->name, in->len, ref.lines);
+
+	for (i = 0; in->len > 0 && i < sizeof bench_streams / sizeof bench_streams[0]; i++)
+	{
+		const bench_stream_t *stream = &bench_streams[i];
+		bench_result_t res;
+		uint64_t start, elapsed;
+		double rate;
+		size_t n;
+
+		/* the baseline predates some parser fixes, so it may disagree on unusual input */
+		res = bench_parse_stream(stream->parse, in, bench_verify_ops);
+		if (res.hash != ref.hash || res.lines != ref.lines)
+		{
+			printf("  %-8s MISMATCH\n", stream->name);
+			ok &= stream->parse == bench_parse_getc;
+		}
+
+		start = bench_now();
+		for (n = 0; n < iters; n++)
+			bench_parse_stream(stream->parse, in, bench_timing_ops);
+		elapsed = bench_now() - start;
+
+		rate = bench_report(stream->name, in, iters, elapsed, base_rate);
+		if (stream->parse == bench_parse_getc)
+			base_rate = rate;
+	}
+
+	for (i = 0; i < sizeof bench_scanners / sizeof bench_scanners[0]; i++)
+	{
+		const bench_scanner_t *scanner = &bench_scanners[i];
+		bench_result_t res;
+		uint64_t start, elapsed;
+		size_t n;
+
+		if (!bench_scanner_usable(scanner))
+			continue;
+
+		res = bench_parse(scanner->scan, in, bench_verify_ops);
+		if (res.hash != ref.hash || res.lines != ref.lines)
+		{
+			printf("  %-8s MISMATCH\n", scanner->name);
+			ok = false;
+			continue;
+		}
+
+		start = bench_now();
+		for (n = 0; n < iters; n++)
+			bench_parse(scanner->scan, in, bench_timing_ops);
+		elapsed = bench_now() - start;
+
+		bench_report(scanner->name, in, iters, elapsed, base_rate);
+	}
+
+	return ok;
+}
+
+int
+main(int argc, char *argv[])
+{
+	bench_input_t in;
+	bool ok = true;
+	int i;
+
+	if (argc < 2)
+	{
+		in = bench_make_small();
+		ok &= bench_run(&in);
+		free(in.buf);
+
+		in = bench_make_meta();
+		ok &= bench_run(&in);
+		free(in.buf);
+
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	for (i = 1; i < argc; i++)
+	{
+		FILE *f = fopen(argv[i], "r");
+
+		if (f == NULL)
+		{
+			perror(argv[i]);
+			return EXIT_FAILURE;
+		}
+
+		in.name = argv[i];
+		in.buf = pkgconf_freadall(f, &in.len);
+		fclose(f);
+
+		if (in.buf == NULL)
+		{
+			perror(argv[i]);
+			return EXIT_FAILURE;
+		}
+
+		ok &= bench_run(&in);
+		free(in.buf);
+	}
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -73,6 +73,8 @@
 #define PKG_DUMP_LICENSE		(((uint64_t) 1) << 45)
 #define PKG_SOLUTION			(((uint64_t) 1) << 46)
 #define PKG_EXISTS_CFLAGS		(((uint64_t) 1) << 47)
+#define PKG_REBUILD_INDEX		(((uint64_t) 1) << 48)
+#define PKG_STATS			(((uint64_t) 1) << 49)
 
 static pkgconf_client_t pkg_client;
 static const pkgconf_fragment_render_ops_t *want_render_ops = NULL;
@@ -444,6 +446,9 @@ apply_variable(pkgconf_client_t *client, pkgconf_pkg_t *world, void *variable, i
 
 		if (var != NULL)
 			printf("%s%s", iter->prev != NULL ? " " : "", var);
+
+		/* looking the variable up may have memoized its expansion */
+		pkgconf_cache_update(client, pkg);
 	}
 
 	printf("\n");
@@ -460,7 +465,6 @@ apply_env_var(const char *prefix, pkgconf_client_t *client, pkgconf_pkg_t *world
 	pkgconf_list_t unfiltered_list = PKGCONF_LIST_INITIALIZER;
 	pkgconf_list_t filtered_list = PKGCONF_LIST_INITIALIZER;
 	unsigned int eflag;
-	char *render_buf;
 
 	eflag = collect_fn(client, world, &unfiltered_list, maxdepth);
 	if (eflag != PKGCONF_PKG_ERRF_OK)
@@ -474,9 +478,9 @@ apply_env_var(const char *prefix, pkgconf_client_t *client, pkgconf_pkg_t *world
 	if (filtered_list.head == NULL)
 		goto out;
 
-	render_buf = pkgconf_fragment_render(&filtered_list, true, want_render_ops);
-	printf("%s='%s'\n", prefix, render_buf);
-	free(render_buf);
+	printf("%s='", prefix);
+	pkgconf_fragment_render_file(&filtered_list, stdout, want_render_ops);
+	printf("'\n");
 
 out:
 	pkgconf_fragment_free(&unfiltered_list);
@@ -604,7 +608,6 @@ apply_cflags(pkgconf_client_t *client, pkgconf_pkg_t *world, void *unused, int m
 	pkgconf_list_t unfiltered_list = PKGCONF_LIST_INITIALIZER;
 	pkgconf_list_t filtered_list = PKGCONF_LIST_INITIALIZER;
 	int eflag;
-	char *render_buf;
 	(void) unused;
 
 	eflag = pkgconf_pkg_cflags(client, world, &unfiltered_list, maxdepth);
@@ -617,9 +620,7 @@ apply_cflags(pkgconf_client_t *client, pkgconf_pkg_t *world, void *unused, int m
 	if (filtered_list.head == NULL)
 		goto out;
 
-	render_buf = pkgconf_fragment_render(&filtered_list, true, want_render_ops);
-	printf("%s", render_buf);
-	free(render_buf);
+	pkgconf_fragment_render_file(&filtered_list, stdout, want_render_ops);
 
 out:
 	pkgconf_fragment_free(&unfiltered_list);
@@ -634,7 +635,6 @@ apply_libs(pkgconf_client_t *client, pkgconf_pkg_t *world, void *unused, int max
 	pkgconf_list_t unfiltered_list = PKGCONF_LIST_INITIALIZER;
 	pkgconf_list_t filtered_list = PKGCONF_LIST_INITIALIZER;
 	int eflag;
-	char *render_buf;
 	(void) unused;
 
 	eflag = pkgconf_pkg_libs(client, world, &unfiltered_list, maxdepth);
@@ -646,9 +646,7 @@ apply_libs(pkgconf_client_t *client, pkgconf_pkg_t *world, void *unused, int max
 	if (filtered_list.head == NULL)
 		goto out;
 
-	render_buf = pkgconf_fragment_render(&filtered_list, true, want_render_ops);
-	printf("%s", render_buf);
-	free(render_buf);
+	pkgconf_fragment_render_file(&filtered_list, stdout, want_render_ops);
 
 out:
 	pkgconf_fragment_free(&unfiltered_list);
@@ -795,6 +793,22 @@ version(void)
 	printf("%s\n", PACKAGE_VERSION);
 }
 
+static void
+print_stats(const pkgconf_client_t *client)
+{
+	pkgconf_client_stats_t stats;
+
+	pkgconf_client_get_stats(client, &stats);
+
+	fprintf(stderr, "cache_hits=%" PRIu64 "\n", stats.cache_hits);
+	fprintf(stderr, "cache_misses=%" PRIu64 "\n", stats.cache_misses);
+	fprintf(stderr, "files_opened=%" PRIu64 "\n", stats.files_opened);
+	fprintf(stderr, "files_parsed=%" PRIu64 "\n", stats.files_parsed);
+	fprintf(stderr, "bytes_read=%" PRIu64 "\n", stats.bytes_read);
+	fprintf(stderr, "provider_scans=%" PRIu64 "\n", stats.provider_scans);
+	fprintf(stderr, "traversal_visits=%" PRIu64 "\n", stats.traversal_visits);
+}
+
 static void
 about(void)
 {
@@ -829,6 +843,8 @@ usage(void)
 	printf("  --silence-errors                  explicitly be silent about errors\n");
 	printf("  --list-all                        list all known packages\n");
 	printf("  --list-package-names              list all known package names\n");
+	printf("  --rebuild-index                   regenerate the module index of every search directory\n");
+	printf("  --stats                           print cache, file and traversal counters on exit\n");
 #ifndef PKGCONF_LITE
 	printf("  --simulate                        simulate walking the calculated dependency graph\n");
 #endif
@@ -995,6 +1011,7 @@ main(int argc, char *argv[])
 	char *builddir;
 	char *sysroot_dir;
 	char *env_traverse_depth;
+	char *env_scan_workers;
 	char *required_pkgconfig_version = NULL;
 	char *required_exact_module_version = NULL;
 	char *required_max_module_version = NULL;
@@ -1093,6 +1110,8 @@ main(int argc, char *argv[])
 		{ "license", no_argument, &want_flags, PKG_DUMP_LICENSE },
 		{ "verbose", no_argument, NULL, 55 },
 		{ "exists-cflags", no_argument, &want_flags, PKG_EXISTS_CFLAGS },
+		{ "rebuild-index", no_argument, &want_flags, PKG_REBUILD_INDEX|PKG_PRINT_ERRORS },
+		{ "stats", no_argument, &want_flags, PKG_STATS },
 		{ NULL, 0, NULL, 0 }
 	};
 
@@ -1194,6 +1213,9 @@ main(int argc, char *argv[])
 	if ((env_traverse_depth = getenv("PKG_CONFIG_MAXIMUM_TRAVERSE_DEPTH")) != NULL)
 		maximum_traverse_depth = atoi(env_traverse_depth);
 
+	if ((env_scan_workers = getenv("PKG_CONFIG_SCAN_WORKERS")) != NULL)
+		pkgconf_client_set_scan_workers(&pkg_client, (unsigned int) strtoul(env_scan_workers, NULL, 10));
+
 	if ((want_flags & PKG_PRINT_ERRORS) != PKG_PRINT_ERRORS)
 		want_flags |= (PKG_SILENCE_ERRORS);
 
@@ -1345,6 +1367,19 @@ main(int argc, char *argv[])
 		}
 	}
 
+	/* if no fragments are going to be printed, only parse the Cflags and Libs fields of a
+	 * package if something asks for them.  --validate wants to see their warnings, and
+	 * --rebuild-index compiles complete packages.
+	 */
+	if (!(want_flags & (PKG_CFLAGS|PKG_LIBS|PKG_VALIDATE|PKG_REBUILD_INDEX)) && want_env_prefix == NULL)
+		want_client_flags |= PKGCONF_PKG_PKGF_DEFER_FRAGMENTS;
+
+	/* likewise, only expand the variables which are looked up or referenced.  --env prints
+	 * every variable as it is stored.
+	 */
+	if (!(want_flags & (PKG_VALIDATE|PKG_REBUILD_INDEX)) && want_env_prefix == NULL)
+		want_client_flags |= PKGCONF_PKG_PKGF_DEFER_VARIABLES;
+
 	/* we have determined what features we want most likely.  in some cases, we override later. */
 	pkgconf_client_set_flags(&pkg_client, want_client_flags);
 
@@ -1361,6 +1396,23 @@ main(int argc, char *argv[])
 		goto out;
 	}
 
+	if ((want_flags & PKG_REBUILD_INDEX) == PKG_REBUILD_INDEX)
+	{
+		pkgconf_node_t *n;
+
+		ret = EXIT_SUCCESS;
+
+		PKGCONF_FOREACH_LIST_ENTRY(pkg_client.dir_list.head, n)
+		{
+			pkgconf_path_t *pnode = n->data;
+
+			if (!pkgconf_dirindex_rebuild(&pkg_client, pnode->path))
+				ret = EXIT_FAILURE;
+		}
+
+		goto out;
+	}
+
 	if ((want_flags & PKG_LIST) == PKG_LIST)
 	{
 		pkgconf_scan_all(&pkg_client, NULL, print_list_entry);
@@ -1687,6 +1739,10 @@ cleanup3:
 out:
 	pkgconf_solution_free(&pkg_client, &world);
 	pkgconf_queue_free(&pkgq);
+
+	if ((want_flags & PKG_STATS) == PKG_STATS)
+		print_stats(&pkg_client);
+
 	pkgconf_cross_personality_deinit(personality);
 	pkgconf_client_deinit(&pkg_client);
 
@@ -160,9 +160,51 @@ msvc_renderer_render_buf(const pkgconf_list_t *list, char *buf, size_t buflen, b
 	*bptr = '\0';
 }
 
+static void
+msvc_renderer_render_write(const pkgconf_list_t *list, pkgconf_fragment_write_func_t write_func, void *data)
+{
+	pkgconf_node_t *node;
+
+	PKGCONF_FOREACH_LIST_ENTRY(list->head, node)
+	{
+		const pkgconf_fragment_t *frag = node->data;
+		char prefix[2] = { '/', frag->type };
+		bool quote;
+
+		if (!allowed_fragment(frag))
+			continue;
+
+		switch(frag->type) {
+		case 'D':
+		case 'I':
+			write_func(prefix, sizeof prefix, data);
+			break;
+		case 'L':
+			write_func("/libpath:", 9, data);
+			break;
+		}
+
+		quote = fragment_should_quote(frag);
+
+		if (quote)
+			write_func("\"", 1, data);
+
+		write_func(frag->data, strlen(frag->data), data);
+
+		if (frag->type == 'l')
+			write_func(".lib", 4, data);
+
+		if (quote)
+			write_func("\"", 1, data);
+
+		write_func(" ", 1, data);
+	}
+}
+
 static const pkgconf_fragment_render_ops_t msvc_renderer_ops = {
 	.render_len = msvc_renderer_render_len,
-	.render_buf = msvc_renderer_render_buf
+	.render_buf = msvc_renderer_render_buf,
+	.render_write = msvc_renderer_render_write
 };
 
 const pkgconf_fragment_render_ops_t *
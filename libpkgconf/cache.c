@@ -16,8 +16,6 @@
 #include <libpkgconf/stdinc.h>
 #include <libpkgconf/libpkgconf.h>
 
-#include <assert.h>
-
 /*
  * !doc
  *
@@ -29,48 +27,224 @@
  *
  * A cache is tied to a specific pkgconf client object, so package objects should not
  * be shared across threads.
+ *
+ * The cache can be bounded by a number of packages and an estimate of their memory use with
+ * :c:func:`pkgconf_cache_set_limits`.  When the cache grows past a limit, the packages used
+ * least recently which are not referenced by anything but the cache (for example by a
+ * dependency graph which is still being used) are evicted.  An evicted package is simply
+ * loaded again the next time it is looked up.
+ *
+ * The cache also remembers modules which could not be found, so that looking them up
+ * again does not probe every search directory.  Such a miss is recorded along with the
+ * generation of the search path (see :c:func:`pkgconf_dirindex_search_generation`) and
+ * forgotten once the search path changes.  Changes to the directories themselves are only
+ * noticed when :c:func:`pkgconf_dirindex_refresh_search` checks them.
  */
 
-static int
-cache_member_cmp(const void *a, const void *b)
+struct pkgconf_cache_miss_ {
+	char *id;
+	uint32_t hash;
+	uint64_t generation;
+};
+
+static uint32_t
+cache_hash(const char *id)
 {
-	const char *key = a;
-	const pkgconf_pkg_t *pkg = *(void **) b;
+	uint32_t hash = 2166136261U;
+
+	for (; *id; id++)
+	{
+		hash ^= (unsigned char) *id;
+		hash *= 16777619U;
+	}
 
-	return strcmp(key, pkg->id);
+	return hash;
 }
 
-static int
-cache_member_sort_cmp(const void *a, const void *b)
+static pkgconf_cache_miss_t *
+cache_miss_slot(pkgconf_cache_miss_t *table, size_t capacity, const char *id, uint32_t hash)
 {
-	const pkgconf_pkg_t *pkgA = *(void **) a;
-	const pkgconf_pkg_t *pkgB = *(void **) b;
+	size_t mask = capacity - 1;
+	size_t i = hash & mask;
 
-	if (pkgA == NULL)
-		return 1;
+	while (table[i].id != NULL && (table[i].hash != hash || strcmp(table[i].id, id)))
+		i = (i + 1) & mask;
 
-	if (pkgB == NULL)
-		return -1;
+	return &table[i];
+}
+
+static bool
+cache_miss_grow(pkgconf_client_t *client)
+{
+	size_t capacity = client->miss_capacity ? client->miss_capacity * 2 : 32;
+	pkgconf_cache_miss_t *table = calloc(capacity, sizeof(pkgconf_cache_miss_t));
+	size_t i;
+
+	if (table == NULL)
+		return false;
 
-	return strcmp(pkgA->id, pkgB->id);
+	for (i = 0; i < client->miss_capacity; i++)
+	{
+		const pkgconf_cache_miss_t *miss = &client->miss_table[i];
+
+		if (miss->id != NULL)
+			*cache_miss_slot(table, capacity, miss->id, miss->hash) = *miss;
+	}
+
+	free(client->miss_table);
+	client->miss_table = table;
+	client->miss_capacity = capacity;
+
+	return true;
 }
 
-static void
-cache_dump(const pkgconf_client_t *client)
+/*
+ * cache_slot(client, pkg, id, hash)
+ *
+ * find the slot holding `pkg`, or if `pkg` is NULL, the first package named `id`.  if there is
+ * no such package, the free slot ending its probe sequence is returned.
+ */
+static pkgconf_pkg_t **
+cache_slot(const pkgconf_client_t *client, const pkgconf_pkg_t *pkg, const char *id, uint32_t hash)
 {
+	size_t mask = client->cache_capacity - 1;
+	size_t i = hash & mask;
+
+	for (; client->cache_table[i] != NULL; i = (i + 1) & mask)
+	{
+		const pkgconf_pkg_t *entry = client->cache_table[i];
+
+		if (pkg != NULL ? entry == pkg : (entry->cache_hash == hash && !strcmp(entry->id, id)))
+			break;
+	}
+
+	return &client->cache_table[i];
+}
+
+static bool
+cache_grow(pkgconf_client_t *client)
+{
+	size_t capacity = client->cache_capacity ? client->cache_capacity * 2 : 64;
+	pkgconf_pkg_t **table = calloc(capacity, sizeof(pkgconf_pkg_t *));
 	size_t i;
 
-	PKGCONF_TRACE(client, "dumping package cache contents");
+	if (table == NULL)
+		return false;
+
+	for (i = 0; i < client->cache_capacity; i++)
+	{
+		pkgconf_pkg_t *pkg = client->cache_table[i];
+		size_t j;
+
+		if (pkg == NULL)
+			continue;
+
+		for (j = pkg->cache_hash & (capacity - 1); table[j] != NULL; j = (j + 1) & (capacity - 1))
+			;
+
+		table[j] = pkg;
+	}
+
+	free(client->cache_table);
+	client->cache_table = table;
+	client->cache_capacity = capacity;
+
+	return true;
+}
+
+static size_t
+cache_string_size(const char *str)
+{
+	return str != NULL ? strlen(str) + 1 : 0;
+}
+
+static size_t
+cache_fragment_list_size(const pkgconf_list_t *list)
+{
+	const pkgconf_node_t *n;
+	size_t size = 0;
+
+	PKGCONF_FOREACH_LIST_ENTRY(list->head, n)
+	{
+		const pkgconf_fragment_t *frag = n->data;
+
+		size += sizeof(pkgconf_fragment_t) + cache_string_size(frag->data);
+	}
+
+	return size;
+}
+
+static size_t
+cache_dependency_list_size(const pkgconf_list_t *list)
+{
+	const pkgconf_node_t *n;
+	size_t size = 0;
 
-	for (i = 0; i < client->cache_count; i++)
+	PKGCONF_FOREACH_LIST_ENTRY(list->head, n)
 	{
-		const pkgconf_pkg_t *pkg = client->cache_table[i];
+		const pkgconf_dependency_t *dep = n->data;
 
-		PKGCONF_TRACE(client, SIZE_FMT_SPECIFIER": %p(%s)",
-			i, pkg, pkg == NULL ? "NULL" : pkg->id);
+		size += sizeof(pkgconf_dependency_t) + cache_string_size(dep->package) + cache_string_size(dep->version);
 	}
+
+	return size;
 }
 
+/*
+ * cache_pkg_size(pkg)
+ *
+ * estimate the memory held by a package object.  allocator overhead is not accounted for.
+ */
+static size_t
+cache_pkg_size(const pkgconf_pkg_t *pkg)
+{
+	const pkgconf_node_t *n;
+	size_t size = sizeof(pkgconf_pkg_t);
+
+	size += cache_string_size(pkg->id) + cache_string_size(pkg->filename) +
+		cache_string_size(pkg->realname) + cache_string_size(pkg->version) +
+		cache_string_size(pkg->description) + cache_string_size(pkg->url) +
+		cache_string_size(pkg->pc_filedir) + cache_string_size(pkg->license) +
+		cache_string_size(pkg->maintainer) + cache_string_size(pkg->copyright) +
+		cache_string_size(pkg->why);
+
+	size += cache_fragment_list_size(&pkg->libs) + cache_fragment_list_size(&pkg->libs_private) +
+		cache_fragment_list_size(&pkg->cflags) + cache_fragment_list_size(&pkg->cflags_private);
+
+	size += cache_dependency_list_size(&pkg->required) + cache_dependency_list_size(&pkg->requires_private) +
+		cache_dependency_list_size(&pkg->conflicts) + cache_dependency_list_size(&pkg->provides);
+
+	PKGCONF_FOREACH_LIST_ENTRY(pkg->vars.head, n)
+	{
+		const pkgconf_tuple_t *tuple = n->data;
+
+		size += sizeof(pkgconf_tuple_t) + cache_string_size(tuple->key) + cache_string_size(tuple->value);
+
+		/* a memoized expansion equal to the value shares its storage */
+		if (tuple->expanded != tuple->value)
+			size += cache_string_size(tuple->expanded);
+	}
+
+	return size;
+}
+
+static bool
+cache_over_limits(const pkgconf_client_t *client)
+{
+	return (client->cache_max_entries && client->cache_count > client->cache_max_entries) ||
+		(client->cache_max_bytes && client->cache_bytes > client->cache_max_bytes);
+}
+
+static void
+cache_lru_push(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
+{
+	pkg->cache_iter.prev = NULL;
+	pkg->cache_iter.next = NULL;
+
+	pkgconf_node_insert_tail(&pkg->cache_iter, pkg, &client->cache_lru);
+}
+
+
 /*
  * !doc
  *
@@ -88,22 +262,28 @@ cache_dump(const pkgconf_client_t *client)
 pkgconf_pkg_t *
 pkgconf_cache_lookup(pkgconf_client_t *client, const char *id)
 {
+	pkgconf_pkg_t *pkg;
+
 	if (client->cache_table == NULL)
+	{
+		client->stats.cache_misses++;
 		return NULL;
+	}
 
-	pkgconf_pkg_t **pkg;
-
-	pkg = bsearch(id, client->cache_table,
-		client->cache_count, sizeof (void *),
-		cache_member_cmp);
-
+	pkg = *cache_slot(client, NULL, id, cache_hash(id));
 	if (pkg != NULL)
 	{
-		PKGCONF_TRACE(client, "found: %s @%p", id, *pkg);
-		return pkgconf_pkg_ref(client, *pkg);
+		PKGCONF_TRACE(client, "found: %s @%p", id, pkg);
+		client->stats.cache_hits++;
+
+		pkgconf_node_delete(&pkg->cache_iter, &client->cache_lru);
+		cache_lru_push(client, pkg);
+
+		return pkgconf_pkg_ref(client, pkg);
 	}
 
 	PKGCONF_TRACE(client, "miss: %s", id);
+	client->stats.cache_misses++;
 	return NULL;
 }
 
@@ -122,7 +302,11 @@ pkgconf_cache_lookup(pkgconf_client_t *client, const char *id)
 void
 pkgconf_cache_add(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
 {
-	if (pkg == NULL)
+	if (pkg == NULL || pkg->flags & PKGCONF_PKG_PROPF_CACHED)
+		return;
+
+	/* keep the table at most half full, so that probe sequences stay short */
+	if ((client->cache_count + 1) * 2 > client->cache_capacity && !cache_grow(client))
 		return;
 
 	pkgconf_pkg_ref(client, pkg);
@@ -131,14 +315,50 @@ pkgconf_cache_add(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
 
 	/* mark package as cached */
 	pkg->flags |= PKGCONF_PKG_PROPF_CACHED;
+	pkg->cache_hash = cache_hash(pkg->id);
+
+	/* the package is not in the table, so this finds the free slot ending its probe sequence */
+	*cache_slot(client, pkg, pkg->id, pkg->cache_hash) = pkg;
+	client->cache_count++;
+
+	pkg->cache_size = cache_pkg_size(pkg);
+	client->cache_bytes += pkg->cache_size;
+	cache_lru_push(client, pkg);
+
+	pkgconf_cache_trim(client);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_cache_update(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
+ *
+ *    Estimates the memory held by a cached package again, after it has grown since it was
+ *    added to the cache, and evicts packages if the cache is over its limits because of that.
+ *    Deferred fragments are parsed and variables are expanded on demand, so a package keeps
+ *    growing after it was loaded.  :c:func:`pkgconf_pkg_load_fragments` calls this itself,
+ *    it is only needed after expanding variables of a cached package directly.
+ *
+ *    :param pkgconf_client_t* client: The client object to modify.
+ *    :param pkgconf_pkg_t* pkg: The package object to account for again.
+ *    :return: nothing
+ */
+void
+pkgconf_cache_update(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
+{
+	size_t size;
 
-	++client->cache_count;
-	client->cache_table = pkgconf_reallocarray(client->cache_table,
-		client->cache_count, sizeof (void *));
-	client->cache_table[client->cache_count - 1] = pkg;
+	if (pkg == NULL || !(pkg->flags & PKGCONF_PKG_PROPF_CACHED))
+		return;
+
+	size = cache_pkg_size(pkg);
+	if (size == pkg->cache_size)
+		return;
 
-	qsort(client->cache_table, client->cache_count,
-		sizeof(void *), cache_member_sort_cmp);
+	client->cache_bytes = client->cache_bytes - pkg->cache_size + size;
+	pkg->cache_size = size;
+
+	pkgconf_cache_trim(client);
 }
 
 /*
@@ -155,6 +375,8 @@ pkgconf_cache_add(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
 void
 pkgconf_cache_remove(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
 {
+	size_t mask, i, j;
+
 	if (client->cache_table == NULL)
 		return;
 
@@ -164,43 +386,192 @@ pkgconf_cache_remove(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
 	if (!(pkg->flags & PKGCONF_PKG_PROPF_CACHED))
 		return;
 
+	mask = client->cache_capacity - 1;
+	i = cache_slot(client, pkg, pkg->id, pkg->cache_hash) - client->cache_table;
+	if (client->cache_table[i] == NULL)
+		return;
+
 	PKGCONF_TRACE(client, "removed @%p from cache", pkg);
 
-	pkgconf_pkg_t **slot;
+	/* shift later members of the probe sequence back, so that no tombstone is needed */
+	for (j = (i + 1) & mask; client->cache_table[j] != NULL; j = (j + 1) & mask)
+	{
+		size_t home = client->cache_table[j]->cache_hash & mask;
 
-	slot = bsearch(pkg->id, client->cache_table,
-		client->cache_count, sizeof (void *),
-		cache_member_cmp);
+		if (((j - home) & mask) >= ((j - i) & mask))
+		{
+			client->cache_table[i] = client->cache_table[j];
+			i = j;
+		}
+	}
 
-	if (slot == NULL)
-		return;
+	client->cache_table[i] = NULL;
+	client->cache_count--;
 
-	(*slot)->flags &= ~PKGCONF_PKG_PROPF_CACHED;
-	pkgconf_pkg_unref(client, *slot);
-	*slot = NULL;
+	pkgconf_node_delete(&pkg->cache_iter, &client->cache_lru);
+	client->cache_bytes -= pkg->cache_size;
 
-	qsort(client->cache_table, client->cache_count,
-		sizeof(void *), cache_member_sort_cmp);
+	pkg->flags &= ~PKGCONF_PKG_PROPF_CACHED;
+	pkgconf_pkg_unref(client, pkg);
+}
 
-	if (client->cache_table[client->cache_count - 1] != NULL)
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_cache_trim(pkgconf_client_t *client)
+ *
+ *    Evicts the least recently used packages which nothing but the cache refers to, until the
+ *    cache is within the limits set by :c:func:`pkgconf_cache_set_limits` again.  This happens
+ *    whenever a package is added to the cache or grows, and when a solution is released by
+ *    :c:func:`pkgconf_solution_free`.
+ *
+ *    :param pkgconf_client_t* client: The client object to modify.
+ *    :return: nothing
+ */
+void
+pkgconf_cache_trim(pkgconf_client_t *client)
+{
+	size_t budget = client->cache_count;
+
+	/* packages which are still referenced are moved to the most recently used end, so
+	 * that each of them is only passed over once.
+	 */
+	while (budget-- > 0 && cache_over_limits(client))
 	{
-		PKGCONF_TRACE(client, "end of cache table refers to %p, not NULL",
-			client->cache_table[client->cache_count - 1]);
-		cache_dump(client);
-		abort();
+		pkgconf_pkg_t *pkg = client->cache_lru.head->data;
+
+		if (pkg->refcount > 1)
+		{
+			pkgconf_node_delete(&pkg->cache_iter, &client->cache_lru);
+			cache_lru_push(client, pkg);
+			continue;
+		}
+
+		PKGCONF_TRACE(client, "evicting %s@%p from cache", pkg->id, pkg);
+		pkgconf_cache_remove(client, pkg);
 	}
+}
 
-	client->cache_count--;
-	if (client->cache_count > 0)
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_cache_set_limits(pkgconf_client_t *client, size_t max_entries, size_t max_bytes)
+ *
+ *    Bounds the package cache of a client object, evicting packages right away if it is
+ *    already larger than that.
+ *
+ *    :param pkgconf_client_t* client: The client object to modify.
+ *    :param size_t max_entries: The maximum number of cached packages, or 0 for no limit.
+ *    :param size_t max_bytes: The maximum estimated memory use of cached packages, or 0 for no limit.
+ *    :return: nothing
+ */
+void
+pkgconf_cache_set_limits(pkgconf_client_t *client, size_t max_entries, size_t max_bytes)
+{
+	client->cache_max_entries = max_entries;
+	client->cache_max_bytes = max_bytes;
+
+	PKGCONF_TRACE(client, "cache limits: " SIZE_FMT_SPECIFIER " entries, " SIZE_FMT_SPECIFIER " bytes", max_entries, max_bytes);
+
+	pkgconf_cache_trim(client);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: size_t pkgconf_cache_get_memory(const pkgconf_client_t *client, size_t *entries)
+ *
+ *    Returns an estimate of the memory held by the packages in the cache of a client object.
+ *    The estimate counts the package objects along with their strings, fragments, dependencies
+ *    and variables, as they were when the packages were added to the cache or last passed to
+ *    :c:func:`pkgconf_cache_update`.
+ *
+ *    :param pkgconf_client_t* client: The client object to query.
+ *    :param size_t* entries: If not ``NULL``, where to store the number of cached packages.
+ *    :return: the estimated number of bytes.
+ *    :rtype: size_t
+ */
+size_t
+pkgconf_cache_get_memory(const pkgconf_client_t *client, size_t *entries)
+{
+	if (entries != NULL)
+		*entries = client->cache_count;
+
+	return client->cache_bytes;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: bool pkgconf_cache_lookup_miss(pkgconf_client_t *client, const char *id)
+ *
+ *    Checks whether a module is known to be missing from the current search path.
+ *
+ *    :param pkgconf_client_t* client: The client object to access.
+ *    :param char* id: The package atom to look up.
+ *    :return: true if an earlier lookup of the module failed and the search path has not changed since, else false.
+ *    :rtype: bool
+ */
+bool
+pkgconf_cache_lookup_miss(pkgconf_client_t *client, const char *id)
+{
+	const pkgconf_cache_miss_t *miss;
+
+	if (client->miss_table == NULL)
+		return false;
+
+	miss = cache_miss_slot(client->miss_table, client->miss_capacity, id, cache_hash(id));
+	if (miss->id == NULL)
+		return false;
+
+	if (miss->generation != pkgconf_dirindex_search_generation(client))
 	{
-		client->cache_table = pkgconf_reallocarray(client->cache_table,
-			client->cache_count, sizeof(void *));
+		PKGCONF_TRACE(client, "stale miss: %s", id);
+		return false;
 	}
-	else
+
+	PKGCONF_TRACE(client, "known missing: %s", id);
+	return true;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_cache_add_miss(pkgconf_client_t *client, const char *id)
+ *
+ *    Records that a module could not be found in the current search path.
+ *
+ *    :param pkgconf_client_t* client: The client object to modify.
+ *    :param char* id: The package atom which could not be found.
+ *    :return: nothing
+ */
+void
+pkgconf_cache_add_miss(pkgconf_client_t *client, const char *id)
+{
+	uint64_t generation = pkgconf_dirindex_search_generation(client);
+	uint32_t hash = cache_hash(id);
+	pkgconf_cache_miss_t *miss;
+
+	/* a search path which cannot be stamped cannot be cached against */
+	if (generation == 0)
+		return;
+
+	if ((client->miss_count + 1) * 2 > client->miss_capacity && !cache_miss_grow(client))
+		return;
+
+	miss = cache_miss_slot(client->miss_table, client->miss_capacity, id, hash);
+	if (miss->id == NULL)
 	{
-		free(client->cache_table);
-		client->cache_table = NULL;
+		if ((miss->id = strdup(id)) == NULL)
+			return;
+
+		miss->hash = hash;
+		client->miss_count++;
 	}
+
+	miss->generation = generation;
+
+	PKGCONF_TRACE(client, "added miss: %s", id);
 }
 
 /*
@@ -217,15 +588,43 @@ pkgconf_cache_remove(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
 void
 pkgconf_cache_free(pkgconf_client_t *client)
 {
+	pkgconf_pkg_t **table;
+	size_t capacity, i;
+
+	for (i = 0; i < client->miss_capacity; i++)
+		free(client->miss_table[i].id);
+
+	free(client->miss_table);
+	client->miss_table = NULL;
+	client->miss_capacity = 0;
+	client->miss_count = 0;
+
 	if (client->cache_table == NULL)
 		return;
 
-	while (client->cache_count > 0)
-		pkgconf_cache_remove(client, client->cache_table[0]);
+	/* detach the table first: releasing a package may release other cached packages */
+	table = client->cache_table;
+	capacity = client->cache_capacity;
 
-	free(client->cache_table);
 	client->cache_table = NULL;
+	client->cache_capacity = 0;
 	client->cache_count = 0;
+	client->cache_bytes = 0;
+	pkgconf_list_zero(&client->cache_lru);
+
+	for (i = 0; i < capacity; i++)
+	{
+		if (table[i] != NULL)
+			table[i]->flags &= ~PKGCONF_PKG_PROPF_CACHED;
+	}
+
+	for (i = 0; i < capacity; i++)
+	{
+		if (table[i] != NULL)
+			pkgconf_pkg_unref(client, table[i]);
+	}
+
+	free(table);
 
 	PKGCONF_TRACE(client, "cleared package cache");
 }
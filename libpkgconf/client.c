@@ -100,6 +100,17 @@ pkgconf_client_init(pkgconf_client_t *client, pkgconf_error_handler_func_t error
 	client->auditf = NULL;
 	client->cache_table = NULL;
 	client->cache_count = 0;
+	client->cache_capacity = 0;
+	client->cache_bytes = 0;
+	client->cache_max_entries = 0;
+	client->cache_max_bytes = 0;
+	pkgconf_list_zero(&client->cache_lru);
+	client->miss_table = NULL;
+	client->miss_capacity = 0;
+	client->miss_count = 0;
+	client->scan_workers = 0;
+	client->provides_index = NULL;
+	pkgconf_client_reset_stats(client);
 
 #ifndef PKGCONF_LITE
 	if (client->trace_handler == NULL)
@@ -139,6 +150,9 @@ pkgconf_client_init(pkgconf_client_t *client, pkgconf_error_handler_func_t error
 	pkgconf_path_build_from_environ("INCLUDE", NULL, &client->filter_includedirs, false);
 #endif
 
+	pkgconf_path_build_set(&client->filter_libdirs);
+	pkgconf_path_build_set(&client->filter_includedirs);
+
 	PKGCONF_TRACE(client, "initialized client @%p", client);
 
 	trace_path_list(client, "filtered library paths", &client->filter_libdirs);
@@ -190,10 +204,13 @@ pkgconf_client_deinit(pkgconf_client_t *client)
 	if (client->buildroot_dir != NULL)
 		free(client->buildroot_dir);
 
+	memset(&client->paths, 0, sizeof client->paths);
+
 	pkgconf_path_free(&client->filter_libdirs);
 	pkgconf_path_free(&client->filter_includedirs);
 
 	pkgconf_tuple_free_global(client);
+	pkgconf_pkg_provides_index_free(client);
 	pkgconf_path_free(&client->dir_list);
 	pkgconf_cache_free(client);
 }
@@ -253,6 +270,8 @@ pkgconf_client_set_sysroot_dir(pkgconf_client_t *client, const char *sysroot_dir
 		free(client->sysroot_dir);
 
 	client->sysroot_dir = sysroot_dir != NULL ? strdup(sysroot_dir) : NULL;
+	client->paths.sysroot_dir = client->sysroot_dir;
+	client->paths.sysroot_len = client->sysroot_dir != NULL ? strlen(client->sysroot_dir) : 0;
 
 	PKGCONF_TRACE(client, "set sysroot_dir to: %s", client->sysroot_dir != NULL ? client->sysroot_dir : "<default>");
 
@@ -489,6 +508,87 @@ pkgconf_client_set_prefix_varname(pkgconf_client_t *client, const char *prefix_v
 	PKGCONF_TRACE(client, "set prefix_varname to: %s", client->prefix_varname);
 }
 
+/*
+ * !doc
+ *
+ * .. c:function:: unsigned int pkgconf_client_get_scan_workers(const pkgconf_client_t *client)
+ *
+ *    Retrieves the number of worker threads used to load packages when scanning whole search directories.
+ *
+ *    :param pkgconf_client_t* client: The client object to retrieve the worker count from.
+ *    :return: the number of worker threads, or 0 if directories are scanned serially
+ *    :rtype: unsigned int
+ */
+unsigned int
+pkgconf_client_get_scan_workers(const pkgconf_client_t *client)
+{
+	return client->scan_workers;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_client_set_scan_workers(pkgconf_client_t *client, unsigned int scan_workers)
+ *
+ *    Sets the number of worker threads used to load packages when scanning whole search directories,
+ *    for example by :c:func:`pkgconf_scan_all`.  Packages are still passed to the iteration function
+ *    one at a time, on the calling thread and in the same order as a serial scan, and messages from
+ *    the workers are delivered to the client's handlers in that order too.  Values of 0 and 1 disable
+ *    the worker pool, as does building libpkgconf without thread support.
+ *
+ *    :param pkgconf_client_t* client: The client object to set the worker count on.
+ *    :param uint scan_workers: The number of worker threads to use.
+ *    :return: nothing
+ */
+void
+pkgconf_client_set_scan_workers(pkgconf_client_t *client, unsigned int scan_workers)
+{
+	client->scan_workers = scan_workers;
+
+	PKGCONF_TRACE(client, "set scan_workers to: %u", client->scan_workers);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_client_get_stats(const pkgconf_client_t *client, pkgconf_client_stats_t *stats)
+ *
+ *    Retrieves the counters a client object keeps about the work it has done since it was
+ *    initialised, or since they were last reset:
+ *
+ *    - ``cache_hits`` and ``cache_misses``: package cache lookups which found a package or not.
+ *    - ``files_opened``: ``.pc`` and ``.pcc`` files opened to load a package.
+ *    - ``files_parsed``: ``.pc`` files run through the parser.
+ *    - ``bytes_read``: the size of the files counted in ``files_opened``.
+ *    - ``provider_scans``: searches for a package which provides a missing dependency.
+ *    - ``traversal_visits``: packages visited while walking dependency graphs.
+ *
+ *    :param pkgconf_client_t* client: The client object to retrieve the counters from.
+ *    :param pkgconf_client_stats_t* stats: Where to store the counters.
+ *    :return: nothing
+ */
+void
+pkgconf_client_get_stats(const pkgconf_client_t *client, pkgconf_client_stats_t *stats)
+{
+	*stats = client->stats;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_client_reset_stats(pkgconf_client_t *client)
+ *
+ *    Resets the counters of a client object to zero.
+ *
+ *    :param pkgconf_client_t* client: The client object whose counters to reset.
+ *    :return: nothing
+ */
+void
+pkgconf_client_reset_stats(pkgconf_client_t *client)
+{
+	memset(&client->stats, 0, sizeof client->stats);
+}
+
 /*
  * !doc
  *
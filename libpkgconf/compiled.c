@@ -0,0 +1,778 @@
+/*
+ * compiled.c
+ * precompiled package objects
+ *
+ * Copyright (c) 2024 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <libpkgconf/config.h>
+#include <libpkgconf/stdinc.h>
+#include <libpkgconf/libpkgconf.h>
+
+#include <errno.h>
+
+#ifndef _WIN32
+# include <fcntl.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+# define PKGCONF_COMPILED_PACKAGES
+# ifdef __APPLE__
+#  define PCC_MTIME_NSEC(st)	((st)->st_mtimespec.tv_nsec)
+# else
+#  define PCC_MTIME_NSEC(st)	((st)->st_mtim.tv_nsec)
+# endif
+#endif
+
+/*
+ * !doc
+ *
+ * libpkgconf `compiled` module
+ * ============================
+ *
+ * The `compiled` module stores parsed package objects in a binary form, so that they can
+ * be loaded again without running the ``.pc`` parser, variable expansion, fragment parsing
+ * and dependency parsing.
+ *
+ * A compiled package lives next to its source file, with a ``.pcc`` extension instead of
+ * ``.pc``.  It consists of a header, arrays of fixed-size records which refer to strings by
+ * their offset in a trailing string table, and the string table itself, so it can be mapped
+ * into memory and used directly.
+ *
+ * The result of parsing a ``.pc`` file depends on the client, so a compiled package records
+ * the client state it was built with (sysroot, global variables, prefix handling and the
+ * client flags which affect parsing) as well as the identity of its source file.  It is
+ * only used while both still match, and only if it was written in a later second than its
+ * source was last modified, as a file system may not keep modification times any finer.
+ */
+
+#ifdef PKGCONF_COMPILED_PACKAGES
+
+#define PCC_MAGIC		"PKGCONFC"
+#define PCC_VERSION		2
+#define PCC_BYTEORDER		0x01020304U
+#define PCC_NONE		0xffffffffU
+
+#define PKG_CONFIG_EXT		".pc"
+
+/* client flags which change the outcome of parsing a .pc file */
+#define PCC_CLIENT_FLAGS_MASK	(PKGCONF_PKG_PKGF_REDEFINE_PREFIX | PKGCONF_PKG_PKGF_DONT_RELOCATE_PATHS | \
+				 PKGCONF_PKG_PKGF_DONT_MERGE_SPECIAL_FRAGMENTS | PKGCONF_PKG_PKGF_FDO_SYSROOT_RULES | \
+				 PKGCONF_PKG_PKGF_PKGCONF1_SYSROOT_RULES)
+
+typedef struct {
+	uint32_t offset;
+	uint32_t count;
+} pcc_array_t;
+
+typedef struct {
+	uint32_t key;
+	uint32_t value;
+	uint32_t flags;
+} pcc_tuple_t;
+
+typedef struct {
+	uint32_t type;
+	uint32_t merged;
+	uint32_t data;
+} pcc_fragment_t;
+
+typedef struct {
+	uint32_t package;
+	uint32_t version;
+	uint32_t compare;
+	uint32_t flags;
+} pcc_dependency_t;
+
+static const ptrdiff_t pcc_string_fields[] = {
+	offsetof(pkgconf_pkg_t, id),
+	offsetof(pkgconf_pkg_t, realname),
+	offsetof(pkgconf_pkg_t, version),
+	offsetof(pkgconf_pkg_t, description),
+	offsetof(pkgconf_pkg_t, url),
+	offsetof(pkgconf_pkg_t, license),
+	offsetof(pkgconf_pkg_t, maintainer),
+	offsetof(pkgconf_pkg_t, copyright),
+};
+
+static const ptrdiff_t pcc_fragment_lists[] = {
+	offsetof(pkgconf_pkg_t, libs),
+	offsetof(pkgconf_pkg_t, libs_private),
+	offsetof(pkgconf_pkg_t, cflags),
+	offsetof(pkgconf_pkg_t, cflags_private),
+};
+
+static const ptrdiff_t pcc_dependency_lists[] = {
+	offsetof(pkgconf_pkg_t, required),
+	offsetof(pkgconf_pkg_t, requires_private),
+	offsetof(pkgconf_pkg_t, conflicts),
+	offsetof(pkgconf_pkg_t, provides),
+};
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteorder;
+	uint32_t header_size;
+	uint32_t file_size;
+
+	uint64_t src_mtime;		/* in nanoseconds */
+	uint64_t src_size;
+	uint64_t src_ino;
+
+	uint32_t key;
+	uint32_t pkg_flags;
+
+	uint32_t strings[PKGCONF_ARRAY_SIZE(pcc_string_fields)];
+	uint32_t orig_prefix;
+	uint32_t prefix;
+
+	pcc_array_t vars;
+	pcc_array_t fragments[PKGCONF_ARRAY_SIZE(pcc_fragment_lists)];
+	pcc_array_t dependencies[PKGCONF_ARRAY_SIZE(pcc_dependency_lists)];
+
+	pcc_array_t strtab;
+} pcc_header_t;
+
+typedef struct {
+	char *buf;
+	size_t len;
+	size_t size;
+	bool failed;
+} pcc_buffer_t;
+
+static uint32_t
+pcc_buffer_append(pcc_buffer_t *buffer, const void *data, size_t len)
+{
+	size_t offset = buffer->len;
+
+	if (len == 0)
+		return offset;
+
+	if (buffer->failed || len > UINT32_MAX - buffer->len)
+	{
+		buffer->failed = true;
+		return PCC_NONE;
+	}
+
+	if (buffer->len + len > buffer->size)
+	{
+		size_t size = buffer->size ? buffer->size : 1024;
+		char *buf;
+
+		while (size < buffer->len + len)
+			size *= 2;
+
+		buf = realloc(buffer->buf, size);
+		if (buf == NULL)
+		{
+			buffer->failed = true;
+			return PCC_NONE;
+		}
+
+		buffer->buf = buf;
+		buffer->size = size;
+	}
+
+	memcpy(buffer->buf + buffer->len, data, len);
+	buffer->len += len;
+
+	return offset;
+}
+
+static uint32_t
+pcc_buffer_append_string(pcc_buffer_t *buffer, const char *str)
+{
+	if (str == NULL)
+		return PCC_NONE;
+
+	return pcc_buffer_append(buffer, str, strlen(str) + 1);
+}
+
+static void
+pcc_buffer_append_key(pcc_buffer_t *buffer, const char *key, const char *value)
+{
+	pcc_buffer_append(buffer, key, strlen(key));
+	pcc_buffer_append(buffer, "=", 1);
+	if (value != NULL)
+		pcc_buffer_append(buffer, value, strlen(value));
+	pcc_buffer_append(buffer, "\n", 1);
+}
+
+/*
+ * pcc_build_key(client, filename, flags, buffer)
+ *
+ * describe everything besides the source file which influences the result of parsing
+ * `filename` with `client`.
+ */
+static void
+pcc_build_key(const pkgconf_client_t *client, const char *filename, unsigned int flags, pcc_buffer_t *buffer)
+{
+	char numbuf[64];
+	pkgconf_node_t *n;
+
+	snprintf(numbuf, sizeof numbuf, "%x:%x", client->flags & PCC_CLIENT_FLAGS_MASK, flags);
+	pcc_buffer_append_key(buffer, "flags", numbuf);
+	pcc_buffer_append_key(buffer, "filename", filename);
+	pcc_buffer_append_key(buffer, "sysroot", client->sysroot_dir);
+	pcc_buffer_append_key(buffer, "buildroot", client->buildroot_dir);
+	pcc_buffer_append_key(buffer, "prefix_varname", client->prefix_varname);
+
+	PKGCONF_FOREACH_LIST_ENTRY(client->global_vars.head, n)
+	{
+		const pkgconf_tuple_t *tuple = n->data;
+
+		snprintf(numbuf, sizeof numbuf, "global:%x:", tuple->flags);
+		pcc_buffer_append(buffer, numbuf, strlen(numbuf));
+		pcc_buffer_append_key(buffer, tuple->key, tuple->value);
+	}
+
+	pcc_buffer_append(buffer, "", 1);
+}
+
+static bool
+pcc_build_path(const char *filename, char *buf, size_t buflen)
+{
+	size_t len = strlen(filename);
+
+	if (len < strlen(PKG_CONFIG_EXT) || strcmp(filename + len - strlen(PKG_CONFIG_EXT), PKG_CONFIG_EXT))
+		return false;
+
+	if (len + 2 > buflen)
+		return false;
+
+	memcpy(buf, filename, len);
+	buf[len] = 'c';
+	buf[len + 1] = '\0';
+
+	return true;
+}
+
+static char *
+pcc_parent_dir(const char *filename)
+{
+	char buf[PKGCONF_ITEM_SIZE], *pathbuf;
+
+	pkgconf_strlcpy(buf, filename, sizeof buf);
+	pathbuf = strrchr(buf, PKG_DIR_SEP_S);
+	if (pathbuf == NULL)
+		pathbuf = strrchr(buf, '/');
+	if (pathbuf != NULL)
+		pathbuf[0] = '\0';
+
+	return strdup(buf);
+}
+
+typedef struct {
+	const char *base;
+	size_t len;
+	const char *strtab;
+	size_t strtab_len;
+	bool failed;
+} pcc_image_t;
+
+static const void *
+pcc_image_array(pcc_image_t *image, const pcc_array_t *array, size_t elemsize)
+{
+	if (array->count == 0)
+		return NULL;
+
+	if (array->offset > image->len || array->count > (image->len - array->offset) / elemsize || array->offset % sizeof(uint32_t))
+	{
+		image->failed = true;
+		return NULL;
+	}
+
+	return image->base + array->offset;
+}
+
+static char *
+pcc_image_strdup(pcc_image_t *image, uint32_t offset)
+{
+	char *str;
+
+	if (offset == PCC_NONE)
+		return NULL;
+
+	if (offset >= image->strtab_len || memchr(image->strtab + offset, '\0', image->strtab_len - offset) == NULL)
+	{
+		image->failed = true;
+		return NULL;
+	}
+
+	str = strdup(image->strtab + offset);
+	if (str == NULL)
+		image->failed = true;
+
+	return str;
+}
+
+static const char *
+pcc_image_string(pcc_image_t *image, uint32_t offset)
+{
+	if (offset == PCC_NONE || offset >= image->strtab_len || memchr(image->strtab + offset, '\0', image->strtab_len - offset) == NULL)
+	{
+		image->failed = true;
+		return NULL;
+	}
+
+	return image->strtab + offset;
+}
+
+static void
+pcc_load_vars(pcc_image_t *image, const pcc_header_t *hdr, pkgconf_pkg_t *pkg)
+{
+	const pcc_tuple_t *tuples = pcc_image_array(image, &hdr->vars, sizeof(pcc_tuple_t));
+	uint32_t i;
+
+	for (i = 0; i < hdr->vars.count && !image->failed; i++)
+	{
+		pkgconf_tuple_t *tuple = calloc(1, sizeof(pkgconf_tuple_t));
+
+		if (tuple == NULL)
+		{
+			image->failed = true;
+			return;
+		}
+
+		pkgconf_node_insert_tail(&tuple->iter, tuple, &pkg->vars);
+
+		tuple->key = pcc_image_strdup(image, tuples[i].key);
+		tuple->value = pcc_image_strdup(image, tuples[i].value);
+		tuple->flags = tuples[i].flags;
+
+		if (tuple->key == NULL || tuple->value == NULL)
+			image->failed = true;
+
+		if (i == hdr->orig_prefix)
+			pkg->orig_prefix = tuple;
+
+		if (i == hdr->prefix)
+			pkg->prefix = tuple;
+	}
+}
+
+static void
+pcc_load_fragments(pcc_image_t *image, const pcc_array_t *array, pkgconf_list_t *list)
+{
+	const pcc_fragment_t *frags = pcc_image_array(image, array, sizeof(pcc_fragment_t));
+	uint32_t i;
+
+	for (i = 0; i < array->count && !image->failed; i++)
+	{
+		pkgconf_fragment_t *frag = calloc(1, sizeof(pkgconf_fragment_t));
+
+		if (frag == NULL)
+		{
+			image->failed = true;
+			return;
+		}
+
+		pkgconf_node_insert_tail(&frag->iter, frag, list);
+
+		frag->type = (char) frags[i].type;
+		frag->merged = frags[i].merged != 0;
+		frag->data = pcc_image_strdup(image, frags[i].data);
+
+		if (frag->data == NULL)
+			image->failed = true;
+	}
+}
+
+static void
+pcc_load_dependencies(pkgconf_client_t *client, pcc_image_t *image, const pcc_array_t *array, pkgconf_list_t *list)
+{
+	const pcc_dependency_t *deps = pcc_image_array(image, array, sizeof(pcc_dependency_t));
+	uint32_t i;
+
+	for (i = 0; i < array->count && !image->failed; i++)
+	{
+		const char *package = pcc_image_string(image, deps[i].package);
+		const char *version = deps[i].version != PCC_NONE ? pcc_image_string(image, deps[i].version) : NULL;
+		pkgconf_dependency_t *dep;
+
+		if (image->failed || deps[i].compare >= PKGCONF_CMP_COUNT)
+		{
+			image->failed = true;
+			return;
+		}
+
+		/* the list was already deduplicated when the package was compiled, so adding the
+		 * nodes in the same order yields the same list.
+		 */
+		dep = pkgconf_dependency_add(client, list, package, version, (pkgconf_pkg_comparator_t) deps[i].compare, deps[i].flags);
+		if (dep != NULL)
+			pkgconf_dependency_unref(dep->owner, dep);
+	}
+}
+
+static inline uint64_t
+pcc_mtime(const struct stat *st)
+{
+	return (uint64_t) st->st_mtime * 1000000000 + PCC_MTIME_NSEC(st);
+}
+
+static pkgconf_pkg_t *
+pcc_load(pkgconf_client_t *client, const char *filename, unsigned int flags, pcc_image_t *image, const struct stat *srcst)
+{
+	const pcc_header_t *hdr = (const pcc_header_t *) image->base;
+	pcc_buffer_t key = {0};
+	pkgconf_pkg_t *pkg;
+	size_t i;
+
+	if (image->len < sizeof(pcc_header_t) || memcmp(hdr->magic, PCC_MAGIC, sizeof hdr->magic) ||
+	    hdr->version != PCC_VERSION || hdr->byteorder != PCC_BYTEORDER ||
+	    hdr->header_size != sizeof(pcc_header_t) || hdr->file_size != image->len)
+		return NULL;
+
+	if (hdr->src_mtime != pcc_mtime(srcst) || hdr->src_size != (uint64_t) srcst->st_size ||
+	    hdr->src_ino != (uint64_t) srcst->st_ino)
+		return NULL;
+
+	if (hdr->strtab.offset > image->len || hdr->strtab.count > image->len - hdr->strtab.offset)
+		return NULL;
+
+	image->strtab = image->base + hdr->strtab.offset;
+	image->strtab_len = hdr->strtab.count;
+
+	pcc_build_key(client, filename, flags & PKGCONF_PKG_PROPF_UNINSTALLED, &key);
+	if (key.failed || hdr->key >= image->strtab_len || image->strtab_len - hdr->key < key.len ||
+	    memcmp(image->strtab + hdr->key, key.buf, key.len))
+	{
+		PKGCONF_TRACE(client, "compiled package for [%s] was built for a different client configuration", filename);
+		free(key.buf);
+		return NULL;
+	}
+
+	free(key.buf);
+
+	pkg = calloc(1, sizeof(pkgconf_pkg_t));
+	if (pkg == NULL)
+		return NULL;
+
+	pkg->owner = client;
+	pkg->filename = strdup(filename);
+	pkg->pc_filedir = pcc_parent_dir(filename);
+	pkg->flags = flags;
+
+	for (i = 0; i < PKGCONF_ARRAY_SIZE(pcc_string_fields); i++)
+	{
+		char **dest = (char **)((char *) pkg + pcc_string_fields[i]);
+		*dest = pcc_image_strdup(image, hdr->strings[i]);
+	}
+
+	pcc_load_vars(image, hdr, pkg);
+
+	for (i = 0; i < PKGCONF_ARRAY_SIZE(pcc_fragment_lists); i++)
+		pcc_load_fragments(image, &hdr->fragments[i], (pkgconf_list_t *)((char *) pkg + pcc_fragment_lists[i]));
+
+	for (i = 0; i < PKGCONF_ARRAY_SIZE(pcc_dependency_lists); i++)
+		pcc_load_dependencies(client, image, &hdr->dependencies[i], (pkgconf_list_t *)((char *) pkg + pcc_dependency_lists[i]));
+
+	if (image->failed || pkg->id == NULL || pkg->filename == NULL || pkg->pc_filedir == NULL)
+	{
+		pkgconf_pkg_free(client, pkg);
+		return NULL;
+	}
+
+	return pkgconf_pkg_ref(client, pkg);
+}
+#endif
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkgconf_pkg_t *pkgconf_pkg_new_from_compiled(pkgconf_client_t *client, const char *filename, FILE *f, unsigned int flags)
+ *
+ *    Load the compiled form of a ``.pc`` file, if there is an up to date one which was built
+ *    with a matching client configuration.  The source file is not read or closed.
+ *
+ *    :param pkgconf_client_t* client: The pkgconf client object to use for dependency resolution.
+ *    :param char* filename: The filename of the package file (including full path).
+ *    :param FILE* f: The source package file.
+ *    :param uint flags: The flags to use when parsing.
+ *    :returns: A ``pkgconf_pkg_t`` object which contains the package data, or ``NULL`` if the source file has to be parsed.
+ *    :rtype: pkgconf_pkg_t *
+ */
+pkgconf_pkg_t *
+pkgconf_pkg_new_from_compiled(pkgconf_client_t *client, const char *filename, FILE *f, unsigned int flags)
+{
+#ifdef PKGCONF_COMPILED_PACKAGES
+	char pccpath[PKGCONF_ITEM_SIZE];
+	struct stat srcst, st;
+	pcc_image_t image = {0};
+	pkgconf_pkg_t *pkg = NULL;
+	void *map;
+	int fd;
+
+	if (!pcc_build_path(filename, pccpath, sizeof pccpath))
+		return NULL;
+
+	if (fstat(fileno(f), &srcst) == -1)
+		return NULL;
+
+	fd = open(pccpath, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size < (off_t) sizeof(pcc_header_t) || st.st_size > UINT32_MAX)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	/* the source may have been modified after it was compiled, within the same second */
+	if (st.st_mtime <= srcst.st_mtime)
+	{
+		PKGCONF_TRACE(client, "compiled package [%s] is not newer than its source", pccpath);
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return NULL;
+
+	client->stats.files_opened++;
+	client->stats.bytes_read += st.st_size;
+
+	image.base = map;
+	image.len = st.st_size;
+
+	pkg = pcc_load(client, filename, flags, &image, &srcst);
+	munmap(map, st.st_size);
+
+	if (pkg != NULL)
+		PKGCONF_TRACE(client, "loaded compiled package [%s]", pccpath);
+
+	return pkg;
+#else
+	(void) client;
+	(void) filename;
+	(void) f;
+	(void) flags;
+
+	return NULL;
+#endif
+}
+
+#ifdef PKGCONF_COMPILED_PACKAGES
+static uint32_t
+pcc_var_index(const pkgconf_pkg_t *pkg, const pkgconf_tuple_t *wanted)
+{
+	pkgconf_node_t *n;
+	uint32_t i = 0;
+
+	if (wanted == NULL)
+		return PCC_NONE;
+
+	PKGCONF_FOREACH_LIST_ENTRY(pkg->vars.head, n)
+	{
+		if (n->data == wanted)
+			return i;
+
+		i++;
+	}
+
+	return PCC_NONE;
+}
+
+static bool
+pcc_vars_deferred(const pkgconf_pkg_t *pkg)
+{
+	pkgconf_node_t *n;
+
+	PKGCONF_FOREACH_LIST_ENTRY(pkg->vars.head, n)
+	{
+		const pkgconf_tuple_t *tuple = n->data;
+
+		if (tuple->flags & PKGCONF_PKG_TUPLEF_DEFERRED)
+			return true;
+	}
+
+	return false;
+}
+
+static void
+pcc_write_array(pcc_buffer_t *body, pcc_array_t *array, const pcc_buffer_t *records, size_t recsize)
+{
+	array->offset = records->len ? pcc_buffer_append(body, records->buf, records->len) : 0;
+	array->count = records->len / recsize;
+}
+#endif
+
+/*
+ * !doc
+ *
+ * .. c:function:: bool pkgconf_pkg_compile(pkgconf_client_t *client, const pkgconf_pkg_t *pkg)
+ *
+ *    Write the compiled form of a package object, which must have been freshly parsed from
+ *    its ``.pc`` file, next to that file.  Deferred fragment fields must have been loaded with
+ *    :c:func:`pkgconf_pkg_load_fragments`, and deferred variables parsed with
+ *    :c:func:`pkgconf_tuple_resolve` first.
+ *
+ *    :param pkgconf_client_t* client: The client object the package was parsed with.
+ *    :param pkgconf_pkg_t* pkg: The package object to compile.
+ *    :return: true on success, else false.
+ *    :rtype: bool
+ */
+bool
+pkgconf_pkg_compile(pkgconf_client_t *client, const pkgconf_pkg_t *pkg)
+{
+#ifdef PKGCONF_COMPILED_PACKAGES
+	char pccpath[PKGCONF_ITEM_SIZE];
+	char tmppath[PKGCONF_ITEM_SIZE + 32];
+	pcc_header_t hdr = {0};
+	pcc_buffer_t strtab = {0}, body = {0}, records = {0}, key = {0};
+	struct stat srcst;
+	pkgconf_node_t *n;
+	size_t i;
+	FILE *out;
+	bool ret = false;
+
+	/* a package whose fragments or variables were not parsed yet cannot be written out completely */
+	if (pkg->filename == NULL || pkg->deferred.head != NULL || pcc_vars_deferred(pkg) ||
+	    !pcc_build_path(pkg->filename, pccpath, sizeof pccpath))
+		return false;
+
+	if (stat(pkg->filename, &srcst) == -1)
+		return false;
+
+	memcpy(hdr.magic, PCC_MAGIC, sizeof hdr.magic);
+	hdr.version = PCC_VERSION;
+	hdr.byteorder = PCC_BYTEORDER;
+	hdr.header_size = sizeof(pcc_header_t);
+	hdr.src_mtime = pcc_mtime(&srcst);
+	hdr.src_size = srcst.st_size;
+	hdr.src_ino = srcst.st_ino;
+	hdr.pkg_flags = pkg->flags & PKGCONF_PKG_PROPF_UNINSTALLED;
+
+	pcc_build_key(client, pkg->filename, hdr.pkg_flags, &key);
+	hdr.key = pcc_buffer_append(&strtab, key.buf, key.len);
+	free(key.buf);
+
+	for (i = 0; i < PKGCONF_ARRAY_SIZE(pcc_string_fields); i++)
+	{
+		char **src = (char **)((char *) pkg + pcc_string_fields[i]);
+		hdr.strings[i] = pcc_buffer_append_string(&strtab, *src);
+	}
+
+	hdr.orig_prefix = pcc_var_index(pkg, pkg->orig_prefix);
+	hdr.prefix = pcc_var_index(pkg, pkg->prefix);
+
+	/* the header is followed by the record arrays, and then the string table */
+	pcc_buffer_append(&body, &hdr, sizeof hdr);
+
+	PKGCONF_FOREACH_LIST_ENTRY(pkg->vars.head, n)
+	{
+		const pkgconf_tuple_t *tuple = n->data;
+		pcc_tuple_t rec = {
+			.key = pcc_buffer_append_string(&strtab, tuple->key),
+			.value = pcc_buffer_append_string(&strtab, tuple->value),
+			.flags = tuple->flags,
+		};
+
+		pcc_buffer_append(&records, &rec, sizeof rec);
+	}
+
+	pcc_write_array(&body, &hdr.vars, &records, sizeof(pcc_tuple_t));
+
+	for (i = 0; i < PKGCONF_ARRAY_SIZE(pcc_fragment_lists); i++)
+	{
+		const pkgconf_list_t *list = (const pkgconf_list_t *)((const char *) pkg + pcc_fragment_lists[i]);
+
+		records.len = 0;
+
+		PKGCONF_FOREACH_LIST_ENTRY(list->head, n)
+		{
+			const pkgconf_fragment_t *frag = n->data;
+			pcc_fragment_t rec = {
+				.type = (unsigned char) frag->type,
+				.merged = frag->merged,
+				.data = pcc_buffer_append_string(&strtab, frag->data),
+			};
+
+			pcc_buffer_append(&records, &rec, sizeof rec);
+		}
+
+		pcc_write_array(&body, &hdr.fragments[i], &records, sizeof(pcc_fragment_t));
+	}
+
+	for (i = 0; i < PKGCONF_ARRAY_SIZE(pcc_dependency_lists); i++)
+	{
+		const pkgconf_list_t *list = (const pkgconf_list_t *)((const char *) pkg + pcc_dependency_lists[i]);
+
+		records.len = 0;
+
+		PKGCONF_FOREACH_LIST_ENTRY(list->head, n)
+		{
+			const pkgconf_dependency_t *dep = n->data;
+			pcc_dependency_t rec = {
+				.package = pcc_buffer_append_string(&strtab, dep->package),
+				.version = pcc_buffer_append_string(&strtab, dep->version),
+				.compare = dep->compare,
+				.flags = dep->flags,
+			};
+
+			pcc_buffer_append(&records, &rec, sizeof rec);
+		}
+
+		pcc_write_array(&body, &hdr.dependencies[i], &records, sizeof(pcc_dependency_t));
+	}
+
+	hdr.strtab.offset = strtab.len ? pcc_buffer_append(&body, strtab.buf, strtab.len) : body.len;
+	hdr.strtab.count = strtab.len;
+	hdr.file_size = body.len;
+
+	if (body.failed || strtab.failed || records.failed)
+		goto out;
+
+	memcpy(body.buf, &hdr, sizeof hdr);
+
+	snprintf(tmppath, sizeof tmppath, "%s.%ld", pccpath, (long) getpid());
+
+	out = fopen(tmppath, "wb");
+	if (out == NULL)
+		goto out;
+
+	if (fwrite(body.buf, 1, body.len, out) != body.len)
+	{
+		fclose(out);
+		unlink(tmppath);
+		goto out;
+	}
+
+	if (fclose(out) != 0 || rename(tmppath, pccpath) == -1)
+	{
+		unlink(tmppath);
+		goto out;
+	}
+
+	PKGCONF_TRACE(client, "wrote compiled package [%s]", pccpath);
+	ret = true;
+
+out:
+	if (!ret)
+		pkgconf_error(client, "%s: unable to write compiled package: %s\n", pccpath, strerror(errno));
+
+	free(strtab.buf);
+	free(body.buf);
+	free(records.buf);
+
+	return ret;
+#else
+	(void) client;
+	(void) pkg;
+
+	return false;
+#endif
+}
@@ -0,0 +1,1189 @@
+/*
+ * dirindex.c
+ * search directory snapshots
+ *
+ * Copyright (c) 2024 pkgconf authors (see AUTHORS).
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * This software is provided 'as is' and without any warranty, express or
+ * implied.  In no event shall the authors be liable for any damages arising
+ * from the use of this software.
+ */
+
+#include <libpkgconf/config.h>
+#include <libpkgconf/stdinc.h>
+#include <libpkgconf/libpkgconf.h>
+
+#include <errno.h>
+
+#ifndef _WIN32
+# include <sys/stat.h>
+# define PKGCONF_PERSISTENT_INDEX
+# define PKGCONF_DIRINDEX_STAMPS
+# ifdef __APPLE__
+#  define DIRINDEX_MTIME_NSEC(st)	((st)->st_mtimespec.tv_nsec)
+# else
+#  define DIRINDEX_MTIME_NSEC(st)	((st)->st_mtim.tv_nsec)
+# endif
+#endif
+
+/*
+ * !doc
+ *
+ * libpkgconf `dirindex` module
+ * ============================
+ *
+ * The `dirindex` module keeps an in-memory snapshot of the modules available in each
+ * search directory.  A directory is read once per client, the first time a package is
+ * looked up in it, so that further lookups are answered from memory and only the
+ * matching file is ever opened.
+ *
+ * Snapshots are attached to the path nodes in the client's `dir_list` and are released
+ * along with them.
+ *
+ * A search directory may additionally carry a persistent index, stored in a file named
+ * ``.pkgconf-index`` inside the directory and generated by ``pkgconf --rebuild-index``.
+ * It records the id, filename, modification time, ``Version`` and ``Provides`` of every
+ * module in the directory, in the order the directory listed them, so that scanning a
+ * directory yields the same order with or without an index.  It is only trusted while the
+ * modification time and inode of the directory match the ones recorded when the index was
+ * written.  When a valid index is present, the directory itself is never listed.  Modules can be edited without the
+ * directory changing, so the records are only handed out for their ``Version`` and
+ * ``Provides`` once the modification time of every module has been checked against them.
+ *
+ * Each snapshot carries a generation stamp derived from the state of its directory when
+ * the snapshot was taken.  Caches which depend on the contents of the search path, such
+ * as the record of modules which could not be found, compare generations to find out
+ * whether they are still valid.
+ */
+
+#ifdef _WIN32
+#	define strncasecmp _strnicmp
+#	define strcasecmp _stricmp
+#endif
+
+/* filesystems on these platforms are case-insensitive by default, so fopen() would
+ * match module names regardless of case.
+ */
+#if defined(_WIN32) || defined(__APPLE__)
+# define DIRINDEX_FOLD_CASE
+#endif
+
+#define PKG_CONFIG_EXT ".pc"
+#define PKG_CONFIG_COMPILED_EXT ".pcc"
+#define PKG_CONFIG_UNINSTALLED_SUFFIX "-uninstalled"
+
+#define DIRINDEX_MAGIC "pkgconf-index 2"
+#define DIRINDEX_FIELDS 5
+
+/* how often a rebuild lists the directory again if it changed while being listed */
+#define DIRINDEX_REBUILD_TRIES 3
+
+typedef struct {
+	char *id;
+	uint32_t hash;
+	unsigned int flags;
+} pkgconf_dirindex_entry_t;
+
+struct pkgconf_dirindex_ {
+	pkgconf_dirindex_entry_t *table;
+	size_t capacity;
+	size_t count;
+
+	bool usable;
+	uint64_t generation;
+
+	/* contents of the persistent index, if one was loaded */
+	bool persistent;
+	bool records_checked;
+	bool records_current;
+	char *buf;
+	pkgconf_dirindex_record_t *records;
+	size_t record_count;
+};
+
+static inline uint32_t
+dirindex_hash(const char *id, size_t len)
+{
+	uint32_t hash = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+#ifdef DIRINDEX_FOLD_CASE
+		hash ^= (unsigned char) tolower((unsigned char) id[i]);
+#else
+		hash ^= (unsigned char) id[i];
+#endif
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static inline bool
+dirindex_id_eq(const char *a, const char *b, size_t len)
+{
+#ifdef DIRINDEX_FOLD_CASE
+	return !strncasecmp(a, b, len) && a[len] == '\0';
+#else
+	return !strncmp(a, b, len) && a[len] == '\0';
+#endif
+}
+
+static pkgconf_dirindex_entry_t *
+dirindex_slot(const pkgconf_dirindex_t *index, const char *id, size_t len, uint32_t hash)
+{
+	size_t mask = index->capacity - 1;
+	size_t i;
+
+	for (i = hash & mask; index->table[i].id != NULL; i = (i + 1) & mask)
+	{
+		pkgconf_dirindex_entry_t *entry = &index->table[i];
+
+		if (entry->hash == hash && dirindex_id_eq(entry->id, id, len))
+			return entry;
+	}
+
+	return &index->table[i];
+}
+
+static bool
+dirindex_grow(pkgconf_dirindex_t *index)
+{
+	pkgconf_dirindex_entry_t *oldtable = index->table;
+	size_t oldcapacity = index->capacity;
+	size_t i;
+
+	index->capacity = oldcapacity ? oldcapacity * 2 : 64;
+	index->table = calloc(index->capacity, sizeof(pkgconf_dirindex_entry_t));
+	if (index->table == NULL)
+	{
+		index->table = oldtable;
+		index->capacity = oldcapacity;
+		return false;
+	}
+
+	for (i = 0; i < oldcapacity; i++)
+	{
+		pkgconf_dirindex_entry_t *entry = &oldtable[i];
+		size_t mask = index->capacity - 1;
+		size_t j;
+
+		if (entry->id == NULL)
+			continue;
+
+		for (j = entry->hash & mask; index->table[j].id != NULL; j = (j + 1) & mask)
+			;
+
+		index->table[j] = *entry;
+	}
+
+	free(oldtable);
+	return true;
+}
+
+static bool
+dirindex_insert(pkgconf_dirindex_t *index, const char *id, size_t len, unsigned int flags)
+{
+	pkgconf_dirindex_entry_t *entry;
+	uint32_t hash = dirindex_hash(id, len);
+
+	/* keep the load factor at or below 1/2 */
+	if ((index->count + 1) * 2 > index->capacity && !dirindex_grow(index))
+		return false;
+
+	entry = dirindex_slot(index, id, len, hash);
+	if (entry->id == NULL)
+	{
+		entry->id = pkgconf_strndup(id, len);
+		if (entry->id == NULL)
+			return false;
+
+		entry->hash = hash;
+		index->count++;
+	}
+
+	entry->flags |= flags;
+	return true;
+}
+
+static bool
+dirindex_has_suffix(const char *str, size_t len, const char *suffix)
+{
+	size_t suf_len = strlen(suffix);
+
+	if (len < suf_len)
+		return false;
+
+#ifdef DIRINDEX_FOLD_CASE
+	return !strncasecmp(str + len - suf_len, suffix, suf_len);
+#else
+	return !strncmp(str + len - suf_len, suffix, suf_len);
+#endif
+}
+
+static bool
+dirindex_add_filename(pkgconf_dirindex_t *index, const char *filename)
+{
+	size_t len = strlen(filename);
+	unsigned int installed_flag = PKGCONF_DIRINDEX_INSTALLED;
+	unsigned int uninstalled_flag = PKGCONF_DIRINDEX_UNINSTALLED;
+
+	if (dirindex_has_suffix(filename, len, PKG_CONFIG_COMPILED_EXT))
+	{
+		len -= strlen(PKG_CONFIG_COMPILED_EXT);
+		installed_flag = PKGCONF_DIRINDEX_COMPILED;
+		uninstalled_flag = PKGCONF_DIRINDEX_UNINSTALLED_COMPILED;
+	}
+	else if (dirindex_has_suffix(filename, len, PKG_CONFIG_EXT))
+		len -= strlen(PKG_CONFIG_EXT);
+	else
+		return true;
+
+	if (!len)
+		return true;
+
+	/* foo-uninstalled.pc is both the installed copy of `foo-uninstalled` and the
+	 * uninstalled copy of `foo`.
+	 */
+	if (!dirindex_insert(index, filename, len, installed_flag))
+		return false;
+
+	if (dirindex_has_suffix(filename, len, PKG_CONFIG_UNINSTALLED_SUFFIX))
+	{
+		size_t base_len = len - strlen(PKG_CONFIG_UNINSTALLED_SUFFIX);
+
+		if (base_len && !dirindex_insert(index, filename, base_len, uninstalled_flag))
+			return false;
+	}
+
+	return true;
+}
+
+#ifdef PKGCONF_PERSISTENT_INDEX
+/* modification times are recorded in nanoseconds, so that changes within a second are seen */
+static inline int64_t
+dirindex_mtime(const struct stat *st)
+{
+	return (int64_t) st->st_mtime * 1000000000 + DIRINDEX_MTIME_NSEC(st);
+}
+
+static void
+dirindex_unload(pkgconf_dirindex_t *index)
+{
+	free(index->records);
+	free(index->buf);
+
+	index->persistent = false;
+	index->records_checked = false;
+	index->records_current = false;
+	index->buf = NULL;
+	index->records = NULL;
+	index->record_count = 0;
+}
+
+static bool
+dirindex_parse_record(char *line, pkgconf_dirindex_record_t *record)
+{
+	char *fields[DIRINDEX_FIELDS];
+	char *end;
+	size_t i;
+
+	for (i = 0; i < DIRINDEX_FIELDS; i++)
+	{
+		fields[i] = line;
+
+		line = strchr(line, '\t');
+		if (line == NULL)
+		{
+			if (i != DIRINDEX_FIELDS - 1)
+				return false;
+
+			break;
+		}
+
+		if (i == DIRINDEX_FIELDS - 1)
+			return false;
+
+		*line++ = '\0';
+	}
+
+	record->id = fields[0];
+	record->filename = fields[1];
+	record->version = fields[3];
+	record->provides = fields[4];
+
+	record->mtime = strtoll(fields[2], &end, 10);
+	if (*end != '\0' || end == fields[2])
+		return false;
+
+	return *record->id != '\0' && *record->filename != '\0' && strchr(record->filename, PKG_DIR_SEP_S) == NULL;
+}
+
+/*
+ * dirindex_load(client, index, path, validate)
+ *
+ * read the persistent index of a search directory into the snapshot.  if `validate` is set,
+ * the index is only accepted if it still describes the directory.
+ */
+static bool
+dirindex_load(pkgconf_client_t *client, pkgconf_dirindex_t *index, const char *path, bool validate)
+{
+	char indexpath[PKGCONF_ITEM_SIZE];
+	struct stat st, dirst;
+	FILE *f;
+	char *line, *next;
+	size_t len, count;
+	int64_t dir_mtime;
+	uint64_t dir_ino;
+
+	snprintf(indexpath, sizeof indexpath, "%s%c%s", path, PKG_DIR_SEP_S, PKGCONF_DIRINDEX_FILENAME);
+
+	f = fopen(indexpath, "r");
+	if (f == NULL)
+		return false;
+
+	if (fstat(fileno(f), &st) == -1 || !S_ISREG(st.st_mode) || stat(path, &dirst) == -1)
+	{
+		fclose(f);
+		return false;
+	}
+
+	len = st.st_size;
+	index->buf = malloc(len + 1);
+	if (index->buf == NULL || fread(index->buf, 1, len, f) != len)
+	{
+		fclose(f);
+		goto invalid;
+	}
+
+	fclose(f);
+	index->buf[len] = '\0';
+
+	if (sscanf(index->buf, DIRINDEX_MAGIC " %" SCNd64 " %" SCNu64, &dir_mtime, &dir_ino) != 2)
+		goto invalid;
+
+	if (validate && (dir_mtime != dirindex_mtime(&dirst) || dir_ino != (uint64_t) dirst.st_ino))
+	{
+		PKGCONF_TRACE(client, "index [%s] is stale", indexpath);
+		goto invalid;
+	}
+
+	line = strchr(index->buf, '\n');
+	if (line == NULL)
+		goto invalid;
+
+	for (count = 0, next = ++line; (next = strchr(next, '\n')) != NULL; next++)
+		count++;
+
+	if (count)
+	{
+		index->records = calloc(count, sizeof(pkgconf_dirindex_record_t));
+		if (index->records == NULL)
+			goto invalid;
+	}
+
+	for (; *line != '\0'; line = next)
+	{
+		next = strchr(line, '\n');
+		if (next == NULL)
+			goto invalid;
+
+		*next++ = '\0';
+
+		if (!dirindex_parse_record(line, &index->records[index->record_count]))
+			goto invalid;
+
+		index->record_count++;
+	}
+
+	index->persistent = true;
+
+	PKGCONF_TRACE(client, "loaded " SIZE_FMT_SPECIFIER " records from index [%s]", index->record_count, indexpath);
+
+	return true;
+
+invalid:
+	PKGCONF_TRACE(client, "ignoring index [%s]", indexpath);
+	dirindex_unload(index);
+	return false;
+}
+#endif
+
+/*
+ * dirindex_stamp(path)
+ *
+ * derive a generation stamp from the current state of a directory.  the stamp changes
+ * whenever entries are added to, removed from or renamed in the directory.
+ */
+static uint64_t
+dirindex_stamp(const char *path)
+{
+#ifdef PKGCONF_DIRINDEX_STAMPS
+	struct stat st;
+	uint64_t stamp = 14695981039346656037ULL;
+
+	if (stat(path, &st) == -1)
+		return 1;
+
+	stamp = (stamp ^ (uint64_t) st.st_dev) * 1099511628211ULL;
+	stamp = (stamp ^ (uint64_t) st.st_ino) * 1099511628211ULL;
+	stamp = (stamp ^ (uint64_t) st.st_mtime) * 1099511628211ULL;
+	stamp = (stamp ^ (uint64_t) DIRINDEX_MTIME_NSEC(&st)) * 1099511628211ULL;
+
+	return stamp | 2;
+#else
+	(void) path;
+
+	return 2;
+#endif
+}
+
+#ifdef PKGCONF_PERSISTENT_INDEX
+/*
+ * dirindex_check_records(client, index, path)
+ *
+ * check that no module was modified in place since the persistent index was written, which
+ * leaves the directory, and thusly the validity of the index itself, untouched.  the result
+ * is kept for the lifetime of the snapshot.
+ */
+static bool
+dirindex_check_records(pkgconf_client_t *client, pkgconf_dirindex_t *index, const char *path)
+{
+	char filebuf[PKGCONF_ITEM_SIZE];
+	struct stat st;
+	size_t i;
+
+	if (index->records_checked)
+		return index->records_current;
+
+	index->records_checked = true;
+
+	for (i = 0; i < index->record_count; i++)
+	{
+		const pkgconf_dirindex_record_t *record = &index->records[i];
+
+		snprintf(filebuf, sizeof filebuf, "%s%c%s", path, PKG_DIR_SEP_S, record->filename);
+
+		if (stat(filebuf, &st) == -1 || dirindex_mtime(&st) != record->mtime)
+		{
+			PKGCONF_TRACE(client, "index of dir [%s] is stale for file [%s]", path, record->filename);
+			return false;
+		}
+	}
+
+	index->records_current = true;
+	return true;
+}
+#endif
+
+static pkgconf_dirindex_t *
+dirindex_build(pkgconf_client_t *client, const char *path)
+{
+	pkgconf_dirindex_t *index;
+	DIR *dir;
+	struct dirent *dirent;
+
+	index = calloc(1, sizeof(pkgconf_dirindex_t));
+	if (index == NULL)
+		return NULL;
+
+	/* taken first, so that changes made while reading the directory bump it later */
+	index->generation = dirindex_stamp(path);
+
+#ifdef PKGCONF_PERSISTENT_INDEX
+	if (dirindex_load(client, index, path, true))
+	{
+		size_t i;
+
+		index->usable = true;
+
+		for (i = 0; i < index->record_count; i++)
+		{
+			if (!dirindex_add_filename(index, index->records[i].filename))
+			{
+				index->usable = false;
+				break;
+			}
+		}
+
+		return index;
+	}
+#endif
+
+	dir = opendir(path);
+	if (dir == NULL)
+	{
+		/* a missing directory simply has no modules, but anything else (e.g. a
+		 * directory we may search but not list) has to be probed the old way.
+		 */
+		index->usable = (errno == ENOENT || errno == ENOTDIR);
+
+		PKGCONF_TRACE(client, "could not open dir [%s] for indexing: %s", path, strerror(errno));
+		return index;
+	}
+
+	index->usable = true;
+
+	for (dirent = readdir(dir); dirent != NULL; dirent = readdir(dir))
+	{
+		if (!dirindex_add_filename(index, dirent->d_name))
+		{
+			index->usable = false;
+			break;
+		}
+	}
+
+	closedir(dir);
+
+	PKGCONF_TRACE(client, "indexed " SIZE_FMT_SPECIFIER " modules in [%s]", index->count, path);
+
+	return index;
+}
+
+static pkgconf_dirindex_t *
+dirindex_get(pkgconf_client_t *client, pkgconf_path_t *pnode)
+{
+	if (pnode->index == NULL)
+		pnode->index = dirindex_build(client, pnode->path);
+
+	return pnode->index;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: bool pkgconf_dirindex_lookup(pkgconf_client_t *client, pkgconf_path_t *pnode, const char *name, unsigned int *flags)
+ *
+ *    Looks up a module in the snapshot of a search directory, reading the directory first if
+ *    it has not been indexed yet.  On success, `flags` is set to a combination of
+ *    ``PKGCONF_DIRINDEX_INSTALLED`` and ``PKGCONF_DIRINDEX_UNINSTALLED`` describing which
+ *    ``.pc`` files exist for the module, and ``PKGCONF_DIRINDEX_COMPILED`` and
+ *    ``PKGCONF_DIRINDEX_UNINSTALLED_COMPILED`` describing which ``.pcc`` files exist, or
+ *    zero if there are none.
+ *
+ *    :param pkgconf_client_t* client: The client object the search directory belongs to.
+ *    :param pkgconf_path_t* pnode: The search directory to look in.
+ *    :param char* name: The module name to look up.
+ *    :param uint* flags: Where to store the lookup result.
+ *    :return: true if the snapshot could answer the query, false if the caller must probe the filesystem itself.
+ *    :rtype: bool
+ */
+bool
+pkgconf_dirindex_lookup(pkgconf_client_t *client, pkgconf_path_t *pnode, const char *name, unsigned int *flags)
+{
+	pkgconf_dirindex_t *index;
+	size_t len;
+
+	/* names with directory components cannot be answered from a flat listing */
+	if (strchr(name, '/') != NULL || strchr(name, PKG_DIR_SEP_S) != NULL)
+		return false;
+
+	index = dirindex_get(client, pnode);
+	if (index == NULL || !index->usable)
+		return false;
+
+	*flags = 0;
+	if (!index->count)
+		return true;
+
+	len = strlen(name);
+	*flags = dirindex_slot(index, name, len, dirindex_hash(name, len))->flags;
+
+	return true;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: uint64_t pkgconf_dirindex_generation(pkgconf_client_t *client, pkgconf_path_t *pnode)
+ *
+ *    Returns the generation stamp of the snapshot of a search directory, reading the directory
+ *    first if it has not been indexed yet.  The stamp only changes when the snapshot is replaced
+ *    by :c:func:`pkgconf_dirindex_refresh` because the directory changed.
+ *
+ *    :param pkgconf_client_t* client: The client object the search directory belongs to.
+ *    :param pkgconf_path_t* pnode: The search directory.
+ *    :return: the generation stamp, or 0 if no snapshot could be taken.
+ *    :rtype: uint64_t
+ */
+uint64_t
+pkgconf_dirindex_generation(pkgconf_client_t *client, pkgconf_path_t *pnode)
+{
+	pkgconf_dirindex_t *index = dirindex_get(client, pnode);
+
+	return index != NULL ? index->generation : 0;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: uint64_t pkgconf_dirindex_search_generation(pkgconf_client_t *client)
+ *
+ *    Combines the generation stamps of every directory in the client's search path.  The result
+ *    changes when a directory is added to or removed from the search path, or when the snapshot
+ *    of one of its directories is replaced.
+ *
+ *    :param pkgconf_client_t* client: The client object whose search path is stamped.
+ *    :return: the combined generation stamp, or 0 if a directory has no snapshot.
+ *    :rtype: uint64_t
+ */
+uint64_t
+pkgconf_dirindex_search_generation(pkgconf_client_t *client)
+{
+	uint64_t stamp = 14695981039346656037ULL;
+	pkgconf_node_t *n;
+
+	PKGCONF_FOREACH_LIST_ENTRY(client->dir_list.head, n)
+	{
+		uint64_t generation = pkgconf_dirindex_generation(client, n->data);
+
+		if (generation == 0)
+			return 0;
+
+		stamp = (stamp ^ generation) * 1099511628211ULL;
+	}
+
+	return stamp != 0 ? stamp : 1;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: bool pkgconf_dirindex_refresh(pkgconf_client_t *client, pkgconf_path_t *pnode)
+ *
+ *    Checks whether a search directory changed since its snapshot was taken, and if so, drops
+ *    the snapshot so that it is taken again on the next lookup.
+ *
+ *    :param pkgconf_client_t* client: The client object the search directory belongs to.
+ *    :param pkgconf_path_t* pnode: The search directory to check.
+ *    :return: true if the snapshot was dropped, else false.
+ *    :rtype: bool
+ */
+bool
+pkgconf_dirindex_refresh(pkgconf_client_t *client, pkgconf_path_t *pnode)
+{
+	if (pnode->index == NULL || pnode->index->generation == dirindex_stamp(pnode->path))
+		return false;
+
+	PKGCONF_TRACE(client, "dir [%s] changed, dropping its snapshot", pnode->path);
+
+	pkgconf_dirindex_free(pnode->index);
+	pnode->index = NULL;
+
+	return true;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: bool pkgconf_dirindex_refresh_search(pkgconf_client_t *client)
+ *
+ *    Calls :c:func:`pkgconf_dirindex_refresh` for every directory of the client's search path,
+ *    which costs a ``stat()`` per directory.  Lookups trust the snapshots, and the modules
+ *    recorded as missing from them, until this is called.  :c:func:`pkgconf_queue_solve` and
+ *    the other functions which solve a queue call it once before solving, so only programs
+ *    which look modules up with :c:func:`pkgconf_pkg_find` directly need to call it.
+ *
+ *    :param pkgconf_client_t* client: The client object whose search path is checked.
+ *    :return: true if any snapshot was dropped, else false.
+ *    :rtype: bool
+ */
+bool
+pkgconf_dirindex_refresh_search(pkgconf_client_t *client)
+{
+	pkgconf_node_t *n;
+	bool changed = false;
+
+	PKGCONF_FOREACH_LIST_ENTRY(client->dir_list.head, n)
+		changed |= pkgconf_dirindex_refresh(client, n->data);
+
+	return changed;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: const pkgconf_dirindex_record_t *pkgconf_dirindex_records(pkgconf_client_t *client, pkgconf_path_t *pnode, size_t *count)
+ *
+ *    Returns the records of the persistent index of a search directory, if it has a valid one
+ *    and none of the modules it describes were modified since it was written.
+ *
+ *    :param pkgconf_client_t* client: The client object the search directory belongs to.
+ *    :param pkgconf_path_t* pnode: The search directory to look in.
+ *    :param size_t* count: Where to store the number of records.
+ *    :return: The records, or ``NULL`` if the directory has no usable persistent index.
+ *    :rtype: const pkgconf_dirindex_record_t *
+ */
+const pkgconf_dirindex_record_t *
+pkgconf_dirindex_records(pkgconf_client_t *client, pkgconf_path_t *pnode, size_t *count)
+{
+	pkgconf_dirindex_t *index = dirindex_get(client, pnode);
+	static const pkgconf_dirindex_record_t empty;
+
+	if (index == NULL || !index->usable || !index->persistent)
+		return NULL;
+
+#ifdef PKGCONF_PERSISTENT_INDEX
+	if (!dirindex_check_records(client, index, pnode->path))
+		return NULL;
+#endif
+
+	*count = index->record_count;
+
+	return index->records != NULL ? index->records : &empty;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: bool pkgconf_dirindex_record_provides(pkgconf_client_t *client, const pkgconf_dirindex_record_t *record, const char *package)
+ *
+ *    Checks whether an index record has a ``Provides`` rule for `package`, regardless of version.
+ *
+ *    :param pkgconf_client_t* client: The client object to use for parsing the rules.
+ *    :param pkgconf_dirindex_record_t* record: The index record to check.
+ *    :param char* package: The name of the provided package.
+ *    :return: true if the module may provide `package`, else false.
+ *    :rtype: bool
+ */
+bool
+pkgconf_dirindex_record_provides(pkgconf_client_t *client, const pkgconf_dirindex_record_t *record, const char *package)
+{
+	pkgconf_list_t provides = PKGCONF_LIST_INITIALIZER;
+	pkgconf_node_t *node;
+	bool ret = false;
+
+	if (*record->provides == '\0' || strstr(record->provides, package) == NULL)
+		return false;
+
+	pkgconf_dependency_parse_str(client, &provides, record->provides, 0);
+
+	PKGCONF_FOREACH_LIST_ENTRY(provides.head, node)
+	{
+		const pkgconf_dependency_t *dep = node->data;
+
+		if (!strcmp(dep->package, package))
+		{
+			ret = true;
+			break;
+		}
+	}
+
+	pkgconf_dependency_free(&provides);
+
+	return ret;
+}
+
+#ifdef PKGCONF_PERSISTENT_INDEX
+static int
+dirindex_record_cmp(const void *a, const void *b)
+{
+	const pkgconf_dirindex_record_t *recA = a;
+	const pkgconf_dirindex_record_t *recB = b;
+
+	return strcmp(recA->filename, recB->filename);
+}
+
+static void
+dirindex_write_field(FILE *f, const char *value)
+{
+	/* tabs and newlines delimit the index, so they cannot appear in a field */
+	for (; *value != '\0'; value++)
+		fputc((*value == '\t' || *value == '\n' || *value == '\r') ? ' ' : *value, f);
+}
+
+static void
+dirindex_write_provides(FILE *f, const pkgconf_pkg_t *pkg)
+{
+	pkgconf_node_t *node;
+
+	PKGCONF_FOREACH_LIST_ENTRY(pkg->provides.head, node)
+	{
+		const pkgconf_dependency_t *dep = node->data;
+
+		if (node != pkg->provides.head)
+			fputs(", ", f);
+
+		dirindex_write_field(f, dep->package);
+
+		if (dep->version != NULL && dep->compare != PKGCONF_CMP_ANY)
+		{
+			fprintf(f, " %s ", pkgconf_pkg_get_comparator(dep));
+			dirindex_write_field(f, dep->version);
+		}
+	}
+}
+
+static bool
+dirindex_count_warnings(const char *msg, const pkgconf_client_t *client, void *data)
+{
+	size_t *count = data;
+
+	(void) msg;
+	(void) client;
+
+	(*count)++;
+	return true;
+}
+
+/*
+ * dirindex_parse_entry(client, out, filebuf)
+ *
+ * parse a module for the index, and write its compiled form alongside it.  modules which
+ * cause warnings are not compiled, so that the warnings are not lost.
+ */
+static void
+dirindex_parse_entry(pkgconf_client_t *client, FILE *out, const char *filebuf)
+{
+	pkgconf_error_handler_func_t warn_handler = client->warn_handler;
+	void *warn_handler_data = client->warn_handler_data;
+	size_t warnings = 0;
+	pkgconf_pkg_t *pkg = NULL;
+	FILE *f;
+
+	PKGCONF_TRACE(client, "indexing file [%s]", filebuf);
+
+	f = fopen(filebuf, "r");
+	if (f != NULL)
+	{
+		pkgconf_client_set_warn_handler(client, dirindex_count_warnings, &warnings);
+		pkg = pkgconf_pkg_new_from_file(client, filebuf, f, 0);
+		if (pkg != NULL)
+		{
+			pkgconf_pkg_load_fragments(client, pkg);
+			pkgconf_tuple_resolve(client, &pkg->vars);
+		}
+		pkgconf_client_set_warn_handler(client, warn_handler, warn_handler_data);
+	}
+
+	if (pkg == NULL)
+	{
+		fputs("\t\n", out);
+		return;
+	}
+
+	if (pkg->version != NULL)
+		dirindex_write_field(out, pkg->version);
+
+	fputc('\t', out);
+	dirindex_write_provides(out, pkg);
+	fputc('\n', out);
+
+	if (!warnings)
+		pkgconf_pkg_compile(client, pkg);
+
+	pkgconf_pkg_unref(client, pkg);
+}
+
+static bool
+dirindex_write_entry(pkgconf_client_t *client, FILE *out, const char *path, const char *filename, const pkgconf_dirindex_t *old)
+{
+	char filebuf[PKGCONF_ITEM_SIZE];
+	char pccbuf[PKGCONF_ITEM_SIZE + 1];
+	struct stat st, pccst;
+	pkgconf_dirindex_record_t key = {
+		.filename = filename,
+	};
+	const pkgconf_dirindex_record_t *prev = NULL;
+	int idlen = (int) (strlen(filename) - strlen(PKG_CONFIG_EXT));
+
+	if (strchr(filename, '\t') != NULL || strchr(filename, '\n') != NULL)
+	{
+		pkgconf_error(client, "%s: cannot index file '%s', its name contains a tab or newline\n", path, filename);
+		return false;
+	}
+
+	snprintf(filebuf, sizeof filebuf, "%s%c%s", path, PKG_DIR_SEP_S, filename);
+	snprintf(pccbuf, sizeof pccbuf, "%sc", filebuf);
+
+	if (stat(filebuf, &st) == -1 || !S_ISREG(st.st_mode))
+		return true;
+
+	fprintf(out, "%.*s\t%s\t%" PRId64 "\t", idlen, filename, filename, dirindex_mtime(&st));
+
+	/* reuse what we already know about files which have not changed since the last rebuild */
+	if (old->record_count)
+		prev = bsearch(&key, old->records, old->record_count, sizeof(pkgconf_dirindex_record_t), dirindex_record_cmp);
+
+	if (prev != NULL && prev->mtime == dirindex_mtime(&st) && stat(pccbuf, &pccst) == 0)
+		fprintf(out, "%s\t%s\n", prev->version, prev->provides);
+	else
+		dirindex_parse_entry(client, out, filebuf);
+
+	/* compiled packages are listed too, so that lookups know whether to look for them */
+	if (stat(pccbuf, &pccst) == 0 && S_ISREG(pccst.st_mode))
+		fprintf(out, "%.*s\t%sc\t%" PRId64 "\t\t\n", idlen, filename, filename, dirindex_mtime(&pccst));
+
+	return true;
+}
+
+static int
+dirindex_name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static void
+dirindex_free_modules(char **names, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		free(names[i]);
+
+	free(names);
+}
+
+/*
+ * dirindex_list_modules(dir, names, count)
+ *
+ * list the filenames of the modules in a directory, in the order readdir() returns them, which
+ * is the order the directory is scanned in when it has no index.
+ */
+static bool
+dirindex_list_modules(DIR *dir, char ***names, size_t *count)
+{
+	struct dirent *dirent;
+	size_t size = 0;
+
+	*names = NULL;
+	*count = 0;
+
+	rewinddir(dir);
+	for (dirent = readdir(dir); dirent != NULL; dirent = readdir(dir))
+	{
+		size_t len = strlen(dirent->d_name);
+
+		if (len <= strlen(PKG_CONFIG_EXT) || !dirindex_has_suffix(dirent->d_name, len, PKG_CONFIG_EXT))
+			continue;
+
+		if (*count == size)
+		{
+			char **newnames = realloc(*names, (size ? size * 2 : 64) * sizeof(char *));
+
+			if (newnames == NULL)
+				return false;
+
+			*names = newnames;
+			size = size ? size * 2 : 64;
+		}
+
+		if (((*names)[*count] = strdup(dirent->d_name)) == NULL)
+			return false;
+
+		(*count)++;
+	}
+
+	return true;
+}
+
+/* check whether two listings name the same modules, in any order */
+static bool
+dirindex_same_modules(char **a, size_t a_count, char **b, size_t b_count)
+{
+	size_t i;
+
+	if (a_count != b_count)
+		return false;
+
+	if (a_count)
+	{
+		qsort(a, a_count, sizeof(char *), dirindex_name_cmp);
+		qsort(b, b_count, sizeof(char *), dirindex_name_cmp);
+	}
+
+	for (i = 0; i < a_count; i++)
+	{
+		if (strcmp(a[i], b[i]))
+			return false;
+	}
+
+	return true;
+}
+#endif
+
+/*
+ * !doc
+ *
+ * .. c:function:: bool pkgconf_dirindex_rebuild(pkgconf_client_t *client, const char *path)
+ *
+ *    Regenerates the persistent index of a search directory, along with the compiled form
+ *    of its modules.  Modules which have not been modified since the previous index was
+ *    written are not parsed again.  A directory which does not exist is not an error.
+ *
+ *    :param pkgconf_client_t* client: The client object to use for parsing modules.
+ *    :param char* path: The search directory to index.
+ *    :return: true on success, else false.
+ *    :rtype: bool
+ */
+bool
+pkgconf_dirindex_rebuild(pkgconf_client_t *client, const char *path)
+{
+#ifdef PKGCONF_PERSISTENT_INDEX
+	char indexpath[PKGCONF_ITEM_SIZE];
+	char tmppath[PKGCONF_ITEM_SIZE + 32];
+	pkgconf_dirindex_t old = {0};
+	struct stat dirst, before;
+	char **names = NULL, **check = NULL;
+	size_t count = 0, check_count = 0;
+	DIR *dir;
+	FILE *out;
+	bool ret = false;
+	int tries;
+
+	dir = opendir(path);
+	if (dir == NULL)
+	{
+		if (errno == ENOENT)
+			return true;
+
+		pkgconf_error(client, "%s: unable to open directory: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	snprintf(indexpath, sizeof indexpath, "%s%c%s", path, PKG_DIR_SEP_S, PKGCONF_DIRINDEX_FILENAME);
+	snprintf(tmppath, sizeof tmppath, "%s.%ld", indexpath, (long) getpid());
+
+	out = fopen(tmppath, "w");
+	if (out == NULL)
+	{
+		pkgconf_error(client, "%s: unable to write index: %s\n", path, strerror(errno));
+		closedir(dir);
+		return false;
+	}
+
+	if (dirindex_load(client, &old, path, false) && old.record_count)
+		qsort(old.records, old.record_count, sizeof(pkgconf_dirindex_record_t), dirindex_record_cmp);
+
+	/* compiling modules changes the directory, so the listing the index was written from is
+	 * checked afterwards by listing the directory again between two stat() calls, and the
+	 * index is written again if a module was added or removed meanwhile.
+	 */
+	for (tries = 0;; tries++)
+	{
+		size_t i;
+		bool current;
+
+		if (!dirindex_list_modules(dir, &names, &count))
+			goto fail;
+
+		/* the header is patched in once the index is in place, as creating it changes the
+		 * modification time of the directory.
+		 */
+		fprintf(out, DIRINDEX_MAGIC " %020" PRId64 " %020" PRIu64 "\n", (int64_t) 0, (uint64_t) 0);
+
+		for (i = 0; i < count; i++)
+		{
+			if (!dirindex_write_entry(client, out, path, names[i], &old))
+				goto out;
+		}
+
+		if (stat(path, &before) == -1 || !dirindex_list_modules(dir, &check, &check_count) || stat(path, &dirst) == -1)
+			goto fail;
+
+		current = dirindex_mtime(&before) == dirindex_mtime(&dirst) && dirindex_same_modules(names, count, check, check_count);
+
+		dirindex_free_modules(names, count);
+		dirindex_free_modules(check, check_count);
+		names = check = NULL;
+		count = check_count = 0;
+
+		if (current)
+			break;
+
+		if (tries + 1 == DIRINDEX_REBUILD_TRIES)
+		{
+			pkgconf_error(client, "%s: unable to write index: the directory kept changing while it was indexed\n", path);
+			goto out;
+		}
+
+		PKGCONF_TRACE(client, "dir [%s] changed while it was indexed, indexing it again", path);
+
+		if (fflush(out) != 0 || ftruncate(fileno(out), 0) == -1)
+			goto fail;
+
+		rewind(out);
+	}
+
+	if (fclose(out) != 0)
+	{
+		out = NULL;
+		pkgconf_error(client, "%s: unable to write index: %s\n", path, strerror(errno));
+		goto out;
+	}
+
+	out = NULL;
+
+	if (rename(tmppath, indexpath) == -1)
+	{
+		pkgconf_error(client, "%s: unable to write index: %s\n", path, strerror(errno));
+		goto out;
+	}
+
+	if (stat(path, &dirst) == -1 || (out = fopen(indexpath, "r+")) == NULL)
+	{
+		pkgconf_error(client, "%s: unable to update index: %s\n", path, strerror(errno));
+		goto out;
+	}
+
+	fprintf(out, DIRINDEX_MAGIC " %020" PRId64 " %020" PRIu64 "\n", dirindex_mtime(&dirst), (uint64_t) dirst.st_ino);
+	ret = (fclose(out) == 0);
+	out = NULL;
+
+	PKGCONF_TRACE(client, "rebuilt index [%s]", indexpath);
+	goto out;
+
+fail:
+	pkgconf_error(client, "%s: unable to write index: %s\n", path, strerror(errno));
+
+out:
+	if (out != NULL)
+		fclose(out);
+
+	dirindex_free_modules(names, count);
+	dirindex_free_modules(check, check_count);
+
+	if (!ret)
+		unlink(tmppath);
+
+	dirindex_unload(&old);
+	closedir(dir);
+
+	return ret;
+#else
+	pkgconf_error(client, "%s: persistent indexes are not supported on this platform\n", path);
+	return false;
+#endif
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_dirindex_free(pkgconf_dirindex_t *index)
+ *
+ *    Releases a search directory snapshot.
+ *
+ *    :param pkgconf_dirindex_t* index: The snapshot to release.
+ *    :return: nothing
+ */
+void
+pkgconf_dirindex_free(pkgconf_dirindex_t *index)
+{
+	size_t i;
+
+	if (index == NULL)
+		return;
+
+	for (i = 0; i < index->capacity; i++)
+		free(index->table[i].id);
+
+	free(index->table);
+	free(index->records);
+	free(index->buf);
+	free(index);
+}
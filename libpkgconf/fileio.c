@@ -122,3 +122,57 @@ pkgconf_fgetline(char *line, size_t size, FILE *stream)
 
 	return line;
 }
+
+/*
+ * !doc
+ *
+ * .. c:function:: char *pkgconf_freadall(FILE *stream, size_t *len)
+ *
+ *    Read the remaining contents of a stream into a newly allocated buffer.
+ *    The buffer is NUL-terminated, but may contain NUL bytes itself, so the
+ *    number of bytes read is returned through `len`.
+ *
+ *    :param FILE* stream: The stream to read from.
+ *    :param size_t* len: Set to the number of bytes read.
+ *    :returns: the buffer, which must be freed by the caller, or NULL on error.
+ *    :rtype: char *
+ */
+char *
+pkgconf_freadall(FILE *stream, size_t *len)
+{
+	size_t size = 8192, used = 0, nread;
+	char *buf = malloc(size);
+
+	if (buf == NULL)
+		return NULL;
+
+	while ((nread = fread(buf + used, 1, size - used - 1, stream)) > 0)
+	{
+		used += nread;
+
+		if (used + 1 == size)
+		{
+			char *newbuf = realloc(buf, size * 2);
+
+			if (newbuf == NULL)
+			{
+				free(buf);
+				return NULL;
+			}
+
+			buf = newbuf;
+			size *= 2;
+		}
+	}
+
+	if (ferror(stream))
+	{
+		free(buf);
+		return NULL;
+	}
+
+	buf[used] = '\0';
+	*len = used;
+
+	return buf;
+}
@@ -16,6 +16,11 @@
 #include <libpkgconf/stdinc.h>
 #include <libpkgconf/libpkgconf.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+# define PKGCONF_FRAGMENT_SSE2
+# include <emmintrin.h>
+#endif
+
 /*
  * !doc
  *
@@ -69,12 +74,12 @@ pkgconf_fragment_is_unmergeable(const char *string)
 }
 
 static inline bool
-pkgconf_fragment_should_munge(const char *string, const char *sysroot_dir)
+pkgconf_fragment_should_munge(const char *string, const char *sysroot_dir, size_t sysroot_len)
 {
 	if (*string != '/')
 		return false;
 
-	if (sysroot_dir != NULL && strncmp(sysroot_dir, string, strlen(sysroot_dir)))
+	if (sysroot_dir != NULL && strncmp(sysroot_dir, string, sysroot_len))
 		return true;
 
 	return false;
@@ -92,32 +97,350 @@ pkgconf_fragment_is_special(const char *string)
 	return pkgconf_fragment_is_unmergeable(string);
 }
 
+/*
+ * pkgconf_fragment_munge(client, buf, buflen, source, client_sysroot, flags)
+ *
+ * copy `source` into `buf`, prefixed with the sysroot if it is a path outside of it.  the sysroot
+ * is the client's one if `client_sysroot` is set and the client has one, and otherwise the value
+ * of the global pc_sysrootdir variable.
+ */
 static inline void
-pkgconf_fragment_munge(const pkgconf_client_t *client, char *buf, size_t buflen, const char *source, const char *sysroot_dir, unsigned int flags)
+pkgconf_fragment_munge(const pkgconf_client_t *client, char *buf, size_t buflen, const char *source, bool client_sysroot, unsigned int flags)
 {
-	*buf = '\0';
+	const pkgconf_path_context_t *paths = &client->paths;
+	size_t len = 0;
 
 	if (!(flags & PKGCONF_PKG_PROPF_UNINSTALLED) || (client->flags & PKGCONF_PKG_PKGF_PKGCONF1_SYSROOT_RULES))
 	{
-		if (sysroot_dir == NULL)
-			sysroot_dir = pkgconf_tuple_find_global(client, "pc_sysrootdir");
+		const char *sysroot_dir = paths->global_sysroot_dir;
+		size_t sysroot_len = paths->global_sysroot_len;
 
-		if (sysroot_dir != NULL && pkgconf_fragment_should_munge(source, sysroot_dir))
-			pkgconf_strlcat(buf, sysroot_dir, buflen);
+		if (client_sysroot && paths->sysroot_dir != NULL)
+		{
+			sysroot_dir = paths->sysroot_dir;
+			sysroot_len = paths->sysroot_len;
+		}
+
+		if (sysroot_dir != NULL && pkgconf_fragment_should_munge(source, sysroot_dir, sysroot_len))
+		{
+			len = sysroot_len < buflen ? sysroot_len : buflen - 1;
+			memcpy(buf, sysroot_dir, len);
+		}
 	}
 
-	pkgconf_strlcat(buf, source, buflen);
+	pkgconf_strlcpy(buf + len, source, buflen - len);
 
 	if (*buf == '/' && !(client->flags & PKGCONF_PKG_PKGF_DONT_RELOCATE_PATHS))
 		pkgconf_path_relocate(buf, buflen);
 }
 
-static inline char *
-pkgconf_fragment_copy_munged(const pkgconf_client_t *client, const char *source, unsigned int flags)
+/*
+ * The data of the fragments created by this module is immutable and reference counted, so that
+ * copying a fragment into another list shares its data instead of duplicating it.  Such
+ * fragments are marked as shared, while fragments built elsewhere keep data which is simply
+ * freed.
+ */
+typedef struct {
+	size_t refcount;
+	char data[];
+} fragment_string_t;
+
+static inline fragment_string_t *
+fragment_string_of(char *data)
+{
+	return (fragment_string_t *)(data - offsetof(fragment_string_t, data));
+}
+
+/* allocate a shared string with room for `len` characters, for the caller to fill in */
+static char *
+fragment_string_alloc(size_t len)
+{
+	fragment_string_t *str = malloc(sizeof(fragment_string_t) + len + 1);
+
+	if (str == NULL)
+		return NULL;
+
+	str->refcount = 1;
+	*str->data = '\0';
+
+	return str->data;
+}
+
+static char *
+fragment_string_new(const char *src)
+{
+	size_t len = strlen(src);
+	char *data = fragment_string_alloc(len);
+
+	if (data != NULL)
+		memcpy(data, src, len + 1);
+
+	return data;
+}
+
+/* set the data of a fragment to a new shared copy of `src` */
+static void
+fragment_set_data(pkgconf_fragment_t *frag, const char *src)
+{
+	frag->data = fragment_string_new(src);
+	frag->shared = frag->data != NULL;
+}
+
+/* make a fragment refer to the data of another one, sharing it if possible */
+static void
+fragment_share_data(pkgconf_fragment_t *frag, const pkgconf_fragment_t *base)
+{
+	if (base->data == NULL)
+		return;
+
+	if (!base->shared)
+	{
+		fragment_set_data(frag, base->data);
+		return;
+	}
+
+	fragment_string_of(base->data)->refcount++;
+	frag->data = base->data;
+	frag->shared = true;
+}
+
+static void
+fragment_release_data(pkgconf_fragment_t *frag)
+{
+	fragment_string_t *str;
+
+	if (frag->data == NULL)
+		return;
+
+	if (!frag->shared)
+	{
+		free(frag->data);
+		return;
+	}
+
+	str = fragment_string_of(frag->data);
+	if (--str->refcount == 0)
+		free(str);
+}
+
+static inline void
+pkgconf_fragment_set_munged(const pkgconf_client_t *client, pkgconf_fragment_t *frag, const char *source, unsigned int flags)
 {
 	char mungebuf[PKGCONF_ITEM_SIZE];
-	pkgconf_fragment_munge(client, mungebuf, sizeof mungebuf, source, client->sysroot_dir, flags);
-	return strdup(mungebuf);
+
+	/* only paths get rewritten, anything else is kept as is unless it has to be truncated */
+	if (*source != '/' && strlen(source) < sizeof mungebuf)
+	{
+		fragment_set_data(frag, source);
+		return;
+	}
+
+	pkgconf_fragment_munge(client, mungebuf, sizeof mungebuf, source, true, flags);
+	fragment_set_data(frag, mungebuf);
+}
+
+/*
+ * Fragment lists which fragments get copied into are indexed by fragment type and data, through
+ * the list's lookup pointer, so that looking for a previous copy of a fragment does not walk the
+ * list.  Each key maps to the number of fragments of the list carrying it and to the last one of
+ * them, which is the one the dedup rules consider.  The index is built on the first lookup, and
+ * only trusted while it accounts for every fragment of the list.
+ */
+#define FRAGMENT_INDEX_MIN	16
+
+typedef struct {
+	uint32_t hash;
+	unsigned int count;
+	pkgconf_fragment_t *last;
+} fragment_slot_t;
+
+typedef struct {
+	size_t capacity;
+	size_t used;
+	size_t entries;
+	fragment_slot_t slots[];
+} fragment_index_t;
+
+static inline uint32_t
+fragment_hash(const pkgconf_fragment_t *frag)
+{
+	uint32_t hash = (2166136261U ^ (unsigned char) frag->type) * 16777619U;
+	const char *p;
+
+	for (p = frag->data; *p != '\0'; p++)
+	{
+		hash ^= (unsigned char) *p;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static inline bool
+fragment_key_equal(const pkgconf_fragment_t *a, const pkgconf_fragment_t *b)
+{
+	return a->type == b->type && (a->data == b->data || !strcmp(a->data, b->data));
+}
+
+static fragment_index_t *
+fragment_index_get(const pkgconf_list_t *list)
+{
+	fragment_index_t *index = list->lookup;
+
+	if (index == NULL || index->entries != list->length)
+		return NULL;
+
+	return index;
+}
+
+static fragment_slot_t *
+fragment_index_slot(fragment_index_t *index, const pkgconf_fragment_t *key, uint32_t hash)
+{
+	size_t mask = index->capacity - 1;
+	size_t i = hash & mask;
+
+	for (; index->slots[i].last != NULL; i = (i + 1) & mask)
+	{
+		if (index->slots[i].hash == hash && fragment_key_equal(index->slots[i].last, key))
+			break;
+	}
+
+	return &index->slots[i];
+}
+
+static void
+fragment_index_drop(pkgconf_list_t *list)
+{
+	free(list->lookup);
+	list->lookup = NULL;
+}
+
+static void
+fragment_index_add(fragment_index_t *index, pkgconf_fragment_t *frag, bool tail)
+{
+	uint32_t hash = fragment_hash(frag);
+	fragment_slot_t *slot = fragment_index_slot(index, frag, hash);
+
+	if (slot->last == NULL)
+	{
+		slot->hash = hash;
+		slot->last = frag;
+		index->used++;
+	}
+	else if (tail)
+		slot->last = frag;
+
+	slot->count++;
+	index->entries++;
+}
+
+static void
+fragment_index_build(pkgconf_list_t *list)
+{
+	size_t capacity = 32;
+	fragment_index_t *index;
+	pkgconf_node_t *node;
+
+	fragment_index_drop(list);
+
+	while (capacity < list->length * 2)
+		capacity *= 2;
+
+	index = calloc(1, sizeof(fragment_index_t) + capacity * sizeof(fragment_slot_t));
+	if (index == NULL)
+		return;
+
+	index->capacity = capacity;
+
+	PKGCONF_FOREACH_LIST_ENTRY(list->head, node)
+		fragment_index_add(index, node->data, true);
+
+	list->lookup = index;
+}
+
+/* link a fragment into a list, at its end if `tail` is set, and account for it */
+static void
+fragment_link(pkgconf_list_t *list, pkgconf_fragment_t *frag, bool tail)
+{
+	fragment_index_t *index = list->lookup;
+
+	if (tail)
+		pkgconf_node_insert_tail(&frag->iter, frag, list);
+	else
+		pkgconf_node_insert(&frag->iter, frag, list);
+
+	if (index == NULL)
+		return;
+
+	/* rebuild if the index went stale, or would be more than half full */
+	if (index->entries + 1 != list->length || (index->used + 1) * 2 > index->capacity)
+	{
+		fragment_index_build(list);
+		return;
+	}
+
+	fragment_index_add(index, frag, tail);
+}
+
+/* account for a fragment which is about to be unlinked from the list */
+static void
+fragment_index_remove(pkgconf_list_t *list, pkgconf_fragment_t *frag)
+{
+	fragment_index_t *index = fragment_index_get(list);
+	fragment_slot_t *slot;
+	pkgconf_node_t *node;
+	size_t mask, i, j;
+
+	if (index == NULL || (slot = fragment_index_slot(index, frag, fragment_hash(frag)))->last == NULL)
+	{
+		fragment_index_drop(list);
+		return;
+	}
+
+	index->entries--;
+
+	if (--slot->count > 0)
+	{
+		if (slot->last != frag)
+			return;
+
+		/* another copy remains, find the one which becomes the last */
+		for (node = frag->iter.prev; node != NULL; node = node->prev)
+		{
+			if (fragment_key_equal(node->data, frag))
+			{
+				slot->last = node->data;
+				return;
+			}
+		}
+
+		fragment_index_drop(list);
+		return;
+	}
+
+	/* shift later members of the probe sequence back, so that it stays unbroken */
+	mask = index->capacity - 1;
+	i = slot - index->slots;
+	for (j = (i + 1) & mask; index->slots[j].last != NULL; j = (j + 1) & mask)
+	{
+		size_t home = index->slots[j].hash & mask;
+
+		if (((j - home) & mask) >= ((j - i) & mask))
+		{
+			index->slots[i] = index->slots[j];
+			i = j;
+		}
+	}
+
+	index->slots[i].last = NULL;
+	index->used--;
+}
+
+static void
+fragment_unlink(pkgconf_list_t *list, pkgconf_fragment_t *frag)
+{
+	fragment_index_remove(list, frag);
+	pkgconf_node_delete(&frag->iter, list);
 }
 
 /*
@@ -141,15 +464,9 @@ pkgconf_fragment_insert(const pkgconf_client_t *client, pkgconf_list_t *list, ch
 
 	frag = calloc(1, sizeof(pkgconf_fragment_t));
 	frag->type = type;
-	frag->data = pkgconf_fragment_copy_munged(client, data, 0);
+	pkgconf_fragment_set_munged(client, frag, data, 0);
 
-	if (tail)
-	{
-		pkgconf_node_insert_tail(&frag->iter, frag, list);
-		return;
-	}
-
-	pkgconf_node_insert(&frag->iter, frag, list);
+	fragment_link(list, frag, tail);
 }
 
 /*
@@ -178,7 +495,7 @@ pkgconf_fragment_add(const pkgconf_client_t *client, pkgconf_list_t *list, const
 		frag = calloc(1, sizeof(pkgconf_fragment_t));
 
 		frag->type = *(string + 1);
-		frag->data = pkgconf_fragment_copy_munged(client, string + 2, flags);
+		pkgconf_fragment_set_munged(client, frag, string + 2, flags);
 
 		PKGCONF_TRACE(client, "added fragment {%c, '%s'} to list @%p", frag->type, frag->data, list);
 	}
@@ -197,10 +514,10 @@ pkgconf_fragment_add(const pkgconf_client_t *client, pkgconf_list_t *list, const
 				size_t len;
 				char *newdata;
 
-				pkgconf_fragment_munge(client, mungebuf, sizeof mungebuf, string, NULL, flags);
+				pkgconf_fragment_munge(client, mungebuf, sizeof mungebuf, string, false, flags);
 
 				len = strlen(parent->data) + strlen(mungebuf) + 2;
-				newdata = malloc(len);
+				newdata = fragment_string_alloc(len);
 
 				pkgconf_strlcpy(newdata, parent->data, len);
 				pkgconf_strlcat(newdata, " ", len);
@@ -208,16 +525,19 @@ pkgconf_fragment_add(const pkgconf_client_t *client, pkgconf_list_t *list, const
 
 				PKGCONF_TRACE(client, "merging '%s' to '%s' to form fragment {'%s'} in list @%p", mungebuf, parent->data, newdata, list);
 
-				free(parent->data);
+				/* the parent is indexed under its old data, so unlink it before that is replaced */
+				fragment_unlink(list, parent);
+
+				fragment_release_data(parent);
 				parent->data = newdata;
+				parent->shared = true;
 				parent->merged = true;
 
 				/* use a copy operation to force a dedup */
-				pkgconf_node_delete(&parent->iter, list);
 				pkgconf_fragment_copy(client, list, parent, false);
 
 				/* the fragment list now (maybe) has the copied node, so free the original */
-				free(parent->data);
+				fragment_release_data(parent);
 				free(parent);
 
 				return;
@@ -227,19 +547,32 @@ pkgconf_fragment_add(const pkgconf_client_t *client, pkgconf_list_t *list, const
 		frag = calloc(1, sizeof(pkgconf_fragment_t));
 
 		frag->type = 0;
-		frag->data = strdup(string);
+		fragment_set_data(frag, string);
 
 		PKGCONF_TRACE(client, "created special fragment {'%s'} in list @%p", frag->data, list);
 	}
 
-	pkgconf_node_insert_tail(&frag->iter, frag, list);
+	fragment_link(list, frag, true);
 }
 
 static inline pkgconf_fragment_t *
 pkgconf_fragment_lookup(pkgconf_list_t *list, const pkgconf_fragment_t *base)
 {
+	fragment_index_t *index;
 	pkgconf_node_t *node;
 
+	if (list->length >= FRAGMENT_INDEX_MIN)
+	{
+		if ((index = fragment_index_get(list)) == NULL)
+		{
+			fragment_index_build(list);
+			index = fragment_index_get(list);
+		}
+
+		if (index != NULL)
+			return fragment_index_slot(index, base, fragment_hash(base))->last;
+	}
+
 	PKGCONF_FOREACH_LIST_ENTRY_REVERSE(list->tail, node)
 	{
 		pkgconf_fragment_t *frag = node->data;
@@ -247,7 +580,7 @@ pkgconf_fragment_lookup(pkgconf_list_t *list, const pkgconf_fragment_t *base)
 		if (base->type != frag->type)
 			continue;
 
-		if (!strcmp(base->data, frag->data))
+		if (base->data == frag->data || !strcmp(base->data, frag->data))
 			return frag;
 	}
 
@@ -389,10 +722,9 @@ pkgconf_fragment_copy(const pkgconf_client_t *client, pkgconf_list_t *list, cons
 
 	frag->type = base->type;
 	frag->merged = base->merged;
-	if (base->data != NULL)
-		frag->data = strdup(base->data);
+	fragment_share_data(frag, base);
 
-	pkgconf_node_insert_tail(&frag->iter, frag, list);
+	fragment_link(list, frag, true);
 }
 
 /*
@@ -449,49 +781,182 @@ pkgconf_fragment_filter(const pkgconf_client_t *client, pkgconf_list_t *dest, pk
 	}
 }
 
-static inline char *
-fragment_quote(const pkgconf_fragment_t *frag)
+/*
+ * How each byte of a fragment is escaped from the shell: 0 never, 1 unless the fragment was
+ * merged from a flag and its argument (the space between them), 2 always.  Bytes outside of
+ * printable ASCII are always escaped, which includes the terminating nul, so that scanning a
+ * run of safe bytes stops at the end of the string by itself.  Where SSE2 is available, long
+ * runs are skipped a vector at a time first, by matching the ranges of bytes which the table
+ * leaves alone.
+ */
+#ifndef _WIN32
+#define FRAGMENT_ESCAPE_BACKSLASH	2
+#else
+#define FRAGMENT_ESCAPE_BACKSLASH	0
+#endif
+
+static const unsigned char fragment_escape_table[256] = {
+	/* control characters */
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	/*  ' '  !  "  #  $  %  &  '  (  )  *  +  ,  -  .  / */
+	1, 2, 2, 2, 0, 2, 2, 2, 0, 0, 2, 0, 0, 0, 0, 0,
+	/*   0  1  2  3  4  5  6  7  8  9  :  ;  <  =  >  ? */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 0, 2, 2,
+	/*   @  A  B  C  D  E  F  G  H  I  J  K  L  M  N  O */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/*   P  Q  R  S  T  U  V  W  X  Y  Z  [  \  ]  ^  _ */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, FRAGMENT_ESCAPE_BACKSLASH, 2, 0, 0,
+	/*   `  a  b  c  d  e  f  g  h  i  j  k  l  m  n  o */
+	2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/*   p  q  r  s  t  u  v  w  x  y  z  {  |  }  ~ DEL */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 0, 2,
+	/* everything else */
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+};
+
+#ifdef PKGCONF_FRAGMENT_SSE2
+/* the bytes of `v` which lie in [lo, lo + n] */
+static inline __m128i
+fragment_sse2_range(__m128i v, char lo, char n)
 {
-	const char *src = frag->data;
-	ssize_t outlen = strlen(src) + 10;
-	char *out, *dst;
+	__m128i x = _mm_sub_epi8(v, _mm_set1_epi8(lo));
 
-	if (frag->data == NULL)
-		return NULL;
+	return _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(n)), x);
+}
 
-	out = dst = calloc(1, outlen);
+/*
+ * skip whole vectors of bytes which need no escaping, the ones classified 0 by the table
+ * above (and 1 if the fragment was merged), stopping at the first vector which holds one
+ * which does or which would extend past `end`.
+ */
+static const char *
+fragment_safe_run_sse2(const char *p, const char *end, bool merged)
+{
+	/* '0' needs no escaping anyway, so it stands in for the space if that does */
+	const __m128i space = _mm_set1_epi8(merged ? ' ' : '0');
+	const __m128i dollar = _mm_set1_epi8('$'), equals = _mm_set1_epi8('='), tilde = _mm_set1_epi8('~');
+#if FRAGMENT_ESCAPE_BACKSLASH == 0
+	const __m128i backslash = _mm_set1_epi8('\\');
+#endif
 
-	for (; *src; src++)
+	for (; end - p >= 16; p += 16)
 	{
-		if (((*src < ' ') ||
-		    (*src >= (' ' + (frag->merged ? 1 : 0)) && *src < '$') ||
-		    (*src > '$' && *src < '(') ||
-		    (*src > ')' && *src < '+') ||
-		    (*src > ':' && *src < '=') ||
-		    (*src > '=' && *src < '@') ||
-		    (*src > 'Z' && *src < '\\') ||
-#ifndef _WIN32
-		    (*src == '\\') ||
+		__m128i v = _mm_loadu_si128((const __m128i *) p);
+		__m128i safe = _mm_or_si128(
+			_mm_or_si128(fragment_sse2_range(v, '+', ':' - '+'), fragment_sse2_range(v, '@', 'Z' - '@')),
+			_mm_or_si128(fragment_sse2_range(v, 'a', 'z' - 'a'), fragment_sse2_range(v, '(', ')' - '(')));
+		int mask;
+
+		safe = _mm_or_si128(safe, _mm_or_si128(fragment_sse2_range(v, '^', '_' - '^'), _mm_cmpeq_epi8(v, space)));
+		safe = _mm_or_si128(safe, _mm_or_si128(_mm_cmpeq_epi8(v, dollar), _mm_or_si128(_mm_cmpeq_epi8(v, equals), _mm_cmpeq_epi8(v, tilde))));
+#if FRAGMENT_ESCAPE_BACKSLASH == 0
+		safe = _mm_or_si128(safe, _mm_cmpeq_epi8(v, backslash));
+#endif
+
+		mask = _mm_movemask_epi8(safe) ^ 0xffff;
+		if (mask != 0)
+			return p + __builtin_ctz(mask);
+	}
+
+	return p;
+}
 #endif
-		    (*src > '\\' && *src < '^') ||
-		    (*src == '`') ||
-		    (*src > 'z' && *src < '~') ||
-		    (*src > '~')))
-			*dst++ = '\\';
 
-		*dst++ = *src;
+/* the length of the run of bytes at `src`, whose data ends at `end`, which need no escaping */
+static inline size_t
+fragment_safe_run(const char *src, const char *end, bool merged)
+{
+	const unsigned char *p = (const unsigned char *) src;
+	unsigned char limit = merged ? 1 : 0;
+
+#ifdef PKGCONF_FRAGMENT_SSE2
+	p = (const unsigned char *) fragment_safe_run_sse2(src, end, merged);
+#else
+	(void) end;
+#endif
 
-		if ((ptrdiff_t)(dst - out) + 2 > outlen)
-		{
-			ptrdiff_t offset = dst - out;
-			outlen *= 2;
-			out = realloc(out, outlen);
-			dst = out + offset;
-		}
+	while (fragment_escape_table[*p] <= limit)
+		p++;
+
+	return (const char *) p - src;
+}
+
+static inline size_t
+fragment_quoted_len(const pkgconf_fragment_t *frag)
+{
+	const char *src = frag->data;
+	const char *end = src + strlen(src);
+	size_t len = 0;
+
+	for (;;)
+	{
+		size_t run = fragment_safe_run(src, end, frag->merged);
+
+		len += run;
+		src += run;
+
+		if (*src == '\0')
+			return len;
+
+		len += 2;
+		src++;
 	}
+}
 
-	*dst = 0;
-	return out;
+/* write the data of a fragment escaped, as runs of characters which need no escaping */
+static void
+fragment_write_quoted(const pkgconf_fragment_t *frag, pkgconf_fragment_write_func_t write_func, void *data)
+{
+	const char *src = frag->data;
+	const char *end = src + strlen(src);
+
+	for (;;)
+	{
+		size_t run = fragment_safe_run(src, end, frag->merged);
+
+		if (run > 0)
+			write_func(src, run, data);
+
+		src += run;
+		if (*src == '\0')
+			return;
+
+		/* the escaped character starts the next run */
+		write_func("\\", 1, data);
+		write_func(src, 1, data);
+		src++;
+	}
+}
+
+/* copy the data of a fragment escaped, returning the end of the copy */
+static char *
+fragment_copy_quoted(char *dst, const pkgconf_fragment_t *frag)
+{
+	const char *src = frag->data;
+	const char *end = src + strlen(src);
+
+	for (;;)
+	{
+		size_t run = fragment_safe_run(src, end, frag->merged);
+
+		memcpy(dst, src, run);
+		dst += run;
+		src += run;
+
+		if (*src == '\0')
+			return dst;
+
+		*dst++ = '\\';
+		*dst++ = *src++;
+	}
 }
 
 static inline size_t
@@ -503,11 +968,7 @@ pkgconf_fragment_len(const pkgconf_fragment_t *frag)
 		len += 2;
 
 	if (frag->data != NULL)
-	{
-		char *quoted = fragment_quote(frag);
-		len += strlen(quoted);
-		free(quoted);
-	}
+		len += fragment_quoted_len(frag);
 
 	return len;
 }
@@ -543,13 +1004,9 @@ fragment_render_buf(const pkgconf_list_t *list, char *buf, size_t buflen, bool e
 	{
 		const pkgconf_fragment_t *frag = node->data;
 		size_t buf_remaining = buflen - (bptr - buf);
-		char *quoted = fragment_quote(frag);
 
-		if (strlen(quoted) > buf_remaining)
-		{
-			free(quoted);
+		if (pkgconf_fragment_len(frag) > buf_remaining)
 			break;
-		}
 
 		if (frag->type)
 		{
@@ -557,11 +1014,8 @@ fragment_render_buf(const pkgconf_list_t *list, char *buf, size_t buflen, bool e
 			*bptr++ = frag->type;
 		}
 
-		if (quoted != NULL)
-		{
-			bptr += pkgconf_strlcpy(bptr, quoted, buf_remaining);
-			free(quoted);
-		}
+		if (frag->data != NULL)
+			bptr = fragment_copy_quoted(bptr, frag);
 
 		if (node->next != NULL)
 			*bptr++ = ' ';
@@ -570,9 +1024,34 @@ fragment_render_buf(const pkgconf_list_t *list, char *buf, size_t buflen, bool e
 	*bptr = '\0';
 }
 
+static void
+fragment_render_write(const pkgconf_list_t *list, pkgconf_fragment_write_func_t write_func, void *data)
+{
+	pkgconf_node_t *node;
+
+	PKGCONF_FOREACH_LIST_ENTRY(list->head, node)
+	{
+		const pkgconf_fragment_t *frag = node->data;
+
+		if (frag->type)
+		{
+			char prefix[2] = { '-', frag->type };
+
+			write_func(prefix, sizeof prefix, data);
+		}
+
+		if (frag->data != NULL)
+			fragment_write_quoted(frag, write_func, data);
+
+		if (node->next != NULL)
+			write_func(" ", 1, data);
+	}
+}
+
 static const pkgconf_fragment_render_ops_t default_render_ops = {
 	.render_len = fragment_render_len,
-	.render_buf = fragment_render_buf
+	.render_buf = fragment_render_buf,
+	.render_write = fragment_render_write
 };
 
 /*
@@ -646,6 +1125,65 @@ pkgconf_fragment_render(const pkgconf_list_t *list, bool escape, const pkgconf_f
 	return buf;
 }
 
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_fragment_render_write(const pkgconf_list_t *list, pkgconf_fragment_write_func_t write_func, void *data, const pkgconf_fragment_render_ops_t *ops)
+ *
+ *    Renders a `fragment list` by handing the rendered text to a write function piece by piece,
+ *    without building the whole string first.  Renderers which do not provide a ``render_write``
+ *    operation are rendered into a buffer, which is then written at once.
+ *
+ *    :param pkgconf_list_t* list: The `fragment list` being rendered.
+ *    :param pkgconf_fragment_write_func_t write_func: The function receiving the rendered text.
+ *    :param void* data: An opaque pointer passed to the write function.
+ *    :param pkgconf_fragment_render_ops_t* ops: An optional ops structure to use for custom renderers, else ``NULL``.
+ *    :return: nothing
+ */
+void
+pkgconf_fragment_render_write(const pkgconf_list_t *list, pkgconf_fragment_write_func_t write_func, void *data, const pkgconf_fragment_render_ops_t *ops)
+{
+	char *buf;
+
+	ops = ops != NULL ? ops : &default_render_ops;
+	if (ops->render_write != NULL)
+	{
+		ops->render_write(list, write_func, data);
+		return;
+	}
+
+	buf = pkgconf_fragment_render(list, true, ops);
+	if (buf == NULL)
+		return;
+
+	write_func(buf, strlen(buf), data);
+	free(buf);
+}
+
+static void
+fragment_write_file(const char *buf, size_t len, void *data)
+{
+	fwrite(buf, 1, len, data);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_fragment_render_file(const pkgconf_list_t *list, FILE *f, const pkgconf_fragment_render_ops_t *ops)
+ *
+ *    Renders a `fragment list` straight into a stdio stream.
+ *
+ *    :param pkgconf_list_t* list: The `fragment list` being rendered.
+ *    :param FILE* f: The stream to write the rendered `fragment list` to.
+ *    :param pkgconf_fragment_render_ops_t* ops: An optional ops structure to use for custom renderers, else ``NULL``.
+ *    :return: nothing
+ */
+void
+pkgconf_fragment_render_file(const pkgconf_list_t *list, FILE *f, const pkgconf_fragment_render_ops_t *ops)
+{
+	pkgconf_fragment_render_write(list, fragment_write_file, f, ops);
+}
+
 /*
  * !doc
  *
@@ -660,9 +1198,9 @@ pkgconf_fragment_render(const pkgconf_list_t *list, bool escape, const pkgconf_f
 void
 pkgconf_fragment_delete(pkgconf_list_t *list, pkgconf_fragment_t *node)
 {
-	pkgconf_node_delete(&node->iter, list);
+	fragment_unlink(list, node);
 
-	free(node->data);
+	fragment_release_data(node);
 	free(node);
 }
 
@@ -685,9 +1223,66 @@ pkgconf_fragment_free(pkgconf_list_t *list)
 	{
 		pkgconf_fragment_t *frag = node->data;
 
-		free(frag->data);
+		fragment_release_data(frag);
 		free(frag);
 	}
+
+	fragment_index_drop(list);
+}
+
+/*
+ * fragment_tokenize(buf)
+ *
+ * split `buf` into arguments in place, with the quoting rules of pkgconf_argv_split().  the
+ * arguments end up packed at the start of the buffer, each terminated by a nul, with empty ones
+ * where separators were repeated.  returns the end of the last argument, or NULL if a quote or
+ * an escape was left open.  unquoting never makes the text longer, so the arguments are written
+ * behind the characters being read.
+ */
+static char *
+fragment_tokenize(char *buf)
+{
+	char *src, *dst = buf;
+	char quote = 0;
+	bool escaped = false;
+
+	for (src = buf; *src; src++)
+	{
+		char c = *src;
+
+		if (escaped)
+		{
+			/* POSIX: only \CHAR is special inside a double quote if CHAR is {$, `, ", \, newline}. */
+			if (quote == '"' && !(c == '$' || c == '`' || c == '"' || c == '\\'))
+				*dst++ = '\\';
+
+			*dst++ = c;
+			escaped = false;
+		}
+		else if (quote)
+		{
+			if (c == quote)
+				quote = 0;
+			else if (c == '\\' && quote != '\'')
+				escaped = true;
+			else
+				*dst++ = c;
+		}
+		else if (isspace((unsigned char) c))
+			*dst++ = '\0';
+		else if (c == '\\')
+			escaped = true;
+		else if (strchr("\"'", c) != NULL)
+			quote = c;
+		else
+			*dst++ = c;
+	}
+
+	if (escaped || quote)
+		return NULL;
+
+	*dst = '\0';
+	return dst;
 }
 
 /*
@@ -707,36 +1302,30 @@ pkgconf_fragment_free(pkgconf_list_t *list)
 bool
 pkgconf_fragment_parse(const pkgconf_client_t *client, pkgconf_list_t *list, pkgconf_list_t *vars, const char *value, unsigned int flags)
 {
-	int i, ret, argc;
-	char **argv;
 	char *repstr = pkgconf_tuple_parse(client, vars, value, flags);
+	char *end, *arg;
 
 	PKGCONF_TRACE(client, "post-subst: [%s] -> [%s]", value, repstr);
 
-	ret = pkgconf_argv_split(repstr, &argc, &argv);
-	if (ret < 0)
+	/* the expanded value is split in place, and its arguments are added straight from it */
+	end = fragment_tokenize(repstr);
+	if (end == NULL)
 	{
-		PKGCONF_TRACE(client, "unable to parse fragment string [%s]", repstr);
+		PKGCONF_TRACE(client, "unable to parse fragment string [%s]", value);
 		free(repstr);
 		return false;
 	}
 
-	for (i = 0; i < argc; i++)
+	for (arg = repstr; arg <= end; arg += strlen(arg) + 1)
 	{
-		PKGCONF_TRACE(client, "processing %s", argv[i]);
+		if (*arg == '\0')
+			continue;
 
-		if (argv[i] == NULL)
-		{
-			PKGCONF_TRACE(client, "parsed fragment string is inconsistent: argc = %d while argv[%d] == NULL", argc, i);
-			pkgconf_argv_free(argv);
-			free(repstr);
-			return false;
-		}
+		PKGCONF_TRACE(client, "processing %s", arg);
 
-		pkgconf_fragment_add(client, list, argv[i], flags);
+		pkgconf_fragment_add(client, list, arg, flags);
 	}
 
-	pkgconf_argv_free(argv);
 	free(repstr);
 
 	return true;
@@ -30,9 +30,15 @@ struct pkgconf_node_ {
 typedef struct {
 	pkgconf_node_t *head, *tail;
 	size_t length;
+
+	/* optional lookup index, owned by the module managing the entries of the list */
+	void *lookup;
+
+	/* bumped by that module when entries are added or removed, if anything depends on it */
+	size_t serial;
 } pkgconf_list_t;
 
-#define PKGCONF_LIST_INITIALIZER		{ NULL, NULL, 0 }
+#define PKGCONF_LIST_INITIALIZER		{ NULL, NULL, 0, NULL, 0 }
 
 static inline void
 pkgconf_list_zero(pkgconf_list_t *list)
@@ -40,6 +46,8 @@ pkgconf_list_zero(pkgconf_list_t *list)
 	list->head = NULL;
 	list->tail = NULL;
 	list->length = 0;
+	list->lookup = NULL;
+	list->serial = 0;
 }
 
 static inline void
@@ -69,6 +69,10 @@ typedef struct pkgconf_path_ pkgconf_path_t;
 typedef struct pkgconf_client_ pkgconf_client_t;
 typedef struct pkgconf_cross_personality_ pkgconf_cross_personality_t;
 typedef struct pkgconf_queue_ pkgconf_queue_t;
+typedef struct pkgconf_dirindex_ pkgconf_dirindex_t;
+typedef struct pkgconf_provides_index_ pkgconf_provides_index_t;
+typedef struct pkgconf_cache_miss_ pkgconf_cache_miss_t;
+typedef struct pkgconf_dirindex_record_ pkgconf_dirindex_record_t;
 
 #define PKGCONF_ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
 
@@ -96,6 +100,9 @@ struct pkgconf_fragment_ {
 	char *data;
 
 	bool merged;
+
+	/* data is a reference counted string shared between copies, see fragment.c */
+	bool shared;
 };
 
 struct pkgconf_dependency_ {
@@ -120,9 +127,21 @@ struct pkgconf_tuple_ {
 	char *value;
 
 	unsigned int flags;
+
+	/* position in the list it was added to, and the flags to expand a deferred value with */
+	size_t order;
+	unsigned int deferred_flags;
+
+	/* memoized result of pkgconf_tuple_parse() on the value, see tuple.c */
+	char *expanded;
+	unsigned int expanded_flags;
+	unsigned int expanded_client_flags;
+	uint64_t expanded_serial;
+	size_t expanded_vars_serial;
 };
 
 #define PKGCONF_PKG_TUPLEF_OVERRIDE		0x1
+#define PKGCONF_PKG_TUPLEF_DEFERRED		0x2
 
 struct pkgconf_path_ {
 	pkgconf_node_t lnode;
@@ -130,6 +149,18 @@ struct pkgconf_path_ {
 	char *path;
 	void *handle_path;
 	void *handle_device;
+
+	pkgconf_dirindex_t *index;
+	int dir_fd;
+};
+
+struct pkgconf_dirindex_record_ {
+	const char *id;
+	const char *filename;
+	const char *version;
+	const char *provides;
+
+	int64_t mtime;
 };
 
 #define PKGCONF_PKG_PROPF_NONE			0x00
@@ -166,6 +197,8 @@ struct pkgconf_pkg_ {
 
 	pkgconf_list_t vars;
 
+	pkgconf_list_t deferred;		/* fragment fields which have not been parsed yet */
+
 	unsigned int flags;
 
 	pkgconf_client_t *owner;
@@ -178,6 +211,10 @@ struct pkgconf_pkg_ {
 
 	uint64_t serial;
 	uint64_t identifier;
+
+	uint32_t cache_hash;
+	size_t cache_size;
+	pkgconf_node_t cache_iter;
 };
 
 typedef bool (*pkgconf_pkg_iteration_func_t)(const pkgconf_pkg_t *pkg, void *data);
@@ -185,6 +222,30 @@ typedef void (*pkgconf_pkg_traverse_func_t)(pkgconf_client_t *client, pkgconf_pk
 typedef bool (*pkgconf_queue_apply_func_t)(pkgconf_client_t *client, pkgconf_pkg_t *world, void *data, int maxdepth);
 typedef bool (*pkgconf_error_handler_func_t)(const char *msg, const pkgconf_client_t *client, void *data);
 
+typedef struct {
+	uint64_t cache_hits;
+	uint64_t cache_misses;
+	uint64_t files_opened;
+	uint64_t files_parsed;
+	uint64_t bytes_read;
+	uint64_t provider_scans;
+	uint64_t traversal_visits;
+} pkgconf_client_stats_t;
+
+/*
+ * The client's sysroot settings, with their lengths, for the code which checks every value and
+ * fragment against them.  The strings belong to the client and its global variables, and the
+ * setters in client.c and the global variable wrappers in tuple.c keep this up to date.
+ */
+typedef struct {
+	const char *sysroot_dir;
+	size_t sysroot_len;
+
+	/* the value of the global pc_sysrootdir variable */
+	const char *global_sysroot_dir;
+	size_t global_sysroot_len;
+} pkgconf_path_context_t;
+
 struct pkgconf_client_ {
 	pkgconf_list_t dir_list;
 
@@ -192,6 +253,7 @@ struct pkgconf_client_ {
 	pkgconf_list_t filter_includedirs;
 
 	pkgconf_list_t global_vars;
+	uint64_t global_vars_serial;
 
 	void *error_handler_data;
 	void *warn_handler_data;
@@ -210,6 +272,8 @@ struct pkgconf_client_ {
 
 	char *prefix_varname;
 
+	pkgconf_path_context_t paths;
+
 	bool already_sent_notice;
 
 	uint64_t serial;
@@ -217,6 +281,21 @@ struct pkgconf_client_ {
 
 	pkgconf_pkg_t **cache_table;
 	size_t cache_count;
+	size_t cache_capacity;
+	size_t cache_bytes;
+	size_t cache_max_entries;
+	size_t cache_max_bytes;
+	pkgconf_list_t cache_lru;
+
+	pkgconf_cache_miss_t *miss_table;
+	size_t miss_capacity;
+	size_t miss_count;
+
+	unsigned int scan_workers;
+
+	pkgconf_provides_index_t *provides_index;
+
+	pkgconf_client_stats_t stats;
 };
 
 struct pkgconf_cross_personality_ {
@@ -246,6 +325,10 @@ PKGCONF_API unsigned int pkgconf_client_get_flags(const pkgconf_client_t *client
 PKGCONF_API void pkgconf_client_set_flags(pkgconf_client_t *client, unsigned int flags);
 PKGCONF_API const char *pkgconf_client_get_prefix_varname(const pkgconf_client_t *client);
 PKGCONF_API void pkgconf_client_set_prefix_varname(pkgconf_client_t *client, const char *prefix_varname);
+PKGCONF_API unsigned int pkgconf_client_get_scan_workers(const pkgconf_client_t *client);
+PKGCONF_API void pkgconf_client_set_scan_workers(pkgconf_client_t *client, unsigned int scan_workers);
+PKGCONF_API void pkgconf_client_get_stats(const pkgconf_client_t *client, pkgconf_client_stats_t *stats);
+PKGCONF_API void pkgconf_client_reset_stats(pkgconf_client_t *client);
 PKGCONF_API pkgconf_error_handler_func_t pkgconf_client_get_warn_handler(const pkgconf_client_t *client);
 PKGCONF_API void pkgconf_client_set_warn_handler(pkgconf_client_t *client, pkgconf_error_handler_func_t warn_handler, void *warn_handler_data);
 PKGCONF_API pkgconf_error_handler_func_t pkgconf_client_get_error_handler(const pkgconf_client_t *client);
@@ -280,6 +363,8 @@ PKGCONF_API void pkgconf_cross_personality_deinit(pkgconf_cross_personality_t *p
 #define PKGCONF_PKG_PKGF_DONT_MERGE_SPECIAL_FRAGMENTS	0x4000
 #define PKGCONF_PKG_PKGF_FDO_SYSROOT_RULES		0x8000
 #define PKGCONF_PKG_PKGF_PKGCONF1_SYSROOT_RULES         0x10000
+#define PKGCONF_PKG_PKGF_DEFER_FRAGMENTS		0x20000
+#define PKGCONF_PKG_PKGF_DEFER_VARIABLES		0x40000
 
 #define PKGCONF_PKG_DEPF_INTERNAL		0x1
 #define PKGCONF_PKG_DEPF_PRIVATE		0x2
@@ -306,6 +391,7 @@ typedef void (*pkgconf_parser_operand_func_t)(void *data, const size_t lineno, c
 typedef void (*pkgconf_parser_warn_func_t)(void *data, const char *fmt, ...);
 
 PKGCONF_API void pkgconf_parser_parse(FILE *f, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename);
+PKGCONF_API void pkgconf_parser_parse_buffer(const char *buf, size_t len, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename);
 
 /* pkg.c */
 PKGCONF_API bool pkgconf_error(const pkgconf_client_t *client, const char *format, ...) PRINTFLIKE(2, 3);
@@ -330,7 +416,9 @@ PKGCONF_API bool pkgconf_default_error_handler(const char *msg, const pkgconf_cl
 PKGCONF_API pkgconf_pkg_t *pkgconf_pkg_ref(pkgconf_client_t *client, pkgconf_pkg_t *pkg);
 PKGCONF_API void pkgconf_pkg_unref(pkgconf_client_t *client, pkgconf_pkg_t *pkg);
 PKGCONF_API void pkgconf_pkg_free(pkgconf_client_t *client, pkgconf_pkg_t *pkg);
+PKGCONF_API void pkgconf_pkg_load_fragments(pkgconf_client_t *client, pkgconf_pkg_t *pkg);
 PKGCONF_API pkgconf_pkg_t *pkgconf_pkg_find(pkgconf_client_t *client, const char *name);
+PKGCONF_API void pkgconf_cache_preload(pkgconf_client_t *client, const char **names, size_t count);
 PKGCONF_API unsigned int pkgconf_pkg_traverse(pkgconf_client_t *client, pkgconf_pkg_t *root, pkgconf_pkg_traverse_func_t func, void *data, int maxdepth, unsigned int skip_flags);
 PKGCONF_API unsigned int pkgconf_pkg_verify_graph(pkgconf_client_t *client, pkgconf_pkg_t *root, int depth);
 PKGCONF_API pkgconf_pkg_t *pkgconf_pkg_verify_dependency(pkgconf_client_t *client, pkgconf_dependency_t *pkgdep, unsigned int *eflags);
@@ -342,6 +430,7 @@ PKGCONF_API pkgconf_pkg_t *pkgconf_builtin_pkg_get(const char *name);
 
 PKGCONF_API int pkgconf_compare_version(const char *a, const char *b);
 PKGCONF_API pkgconf_pkg_t *pkgconf_scan_all(pkgconf_client_t *client, void *ptr, pkgconf_pkg_iteration_func_t func);
+PKGCONF_API void pkgconf_pkg_provides_index_free(pkgconf_client_t *client);
 
 /* parse.c */
 PKGCONF_API pkgconf_pkg_t *pkgconf_pkg_new_from_file(pkgconf_client_t *client, const char *path, FILE *f, unsigned int flags);
@@ -360,9 +449,14 @@ PKGCONF_API int pkgconf_argv_split(const char *src, int *argc, char ***argv);
 PKGCONF_API void pkgconf_argv_free(char **argv);
 
 /* fragment.c */
+typedef void (*pkgconf_fragment_write_func_t)(const char *buf, size_t len, void *data);
+
 typedef struct pkgconf_fragment_render_ops_ {
 	size_t (*render_len)(const pkgconf_list_t *list, bool escape);
 	void (*render_buf)(const pkgconf_list_t *list, char *buf, size_t len, bool escape);
+
+	/* optional, renders in one pass through a write function */
+	void (*render_write)(const pkgconf_list_t *list, pkgconf_fragment_write_func_t write_func, void *data);
 } pkgconf_fragment_render_ops_t;
 
 typedef bool (*pkgconf_fragment_filter_func_t)(const pkgconf_client_t *client, const pkgconf_fragment_t *frag, void *data);
@@ -377,13 +471,18 @@ PKGCONF_API void pkgconf_fragment_filter(const pkgconf_client_t *client, pkgconf
 PKGCONF_API size_t pkgconf_fragment_render_len(const pkgconf_list_t *list, bool escape, const pkgconf_fragment_render_ops_t *ops);
 PKGCONF_API void pkgconf_fragment_render_buf(const pkgconf_list_t *list, char *buf, size_t len, bool escape, const pkgconf_fragment_render_ops_t *ops);
 PKGCONF_API char *pkgconf_fragment_render(const pkgconf_list_t *list, bool escape, const pkgconf_fragment_render_ops_t *ops);
+PKGCONF_API void pkgconf_fragment_render_write(const pkgconf_list_t *list, pkgconf_fragment_write_func_t write_func, void *data, const pkgconf_fragment_render_ops_t *ops);
+PKGCONF_API void pkgconf_fragment_render_file(const pkgconf_list_t *list, FILE *f, const pkgconf_fragment_render_ops_t *ops);
 PKGCONF_API bool pkgconf_fragment_has_system_dir(const pkgconf_client_t *client, const pkgconf_fragment_t *frag);
 
 /* fileio.c */
 PKGCONF_API char *pkgconf_fgetline(char *line, size_t size, FILE *stream);
+PKGCONF_API char *pkgconf_freadall(FILE *stream, size_t *len);
 
 /* tuple.c */
 PKGCONF_API pkgconf_tuple_t *pkgconf_tuple_add(const pkgconf_client_t *client, pkgconf_list_t *parent, const char *key, const char *value, bool parse, unsigned int flags);
+PKGCONF_API pkgconf_tuple_t *pkgconf_tuple_add_deferred(const pkgconf_client_t *client, pkgconf_list_t *parent, const char *key, const char *value, unsigned int flags);
+PKGCONF_API void pkgconf_tuple_resolve(const pkgconf_client_t *client, pkgconf_list_t *list);
 PKGCONF_API char *pkgconf_tuple_find(const pkgconf_client_t *client, pkgconf_list_t *list, const char *key);
 PKGCONF_API char *pkgconf_tuple_parse(const pkgconf_client_t *client, pkgconf_list_t *list, const char *value, unsigned int flags);
 PKGCONF_API void pkgconf_tuple_free(pkgconf_list_t *list);
@@ -406,8 +505,36 @@ PKGCONF_API void pkgconf_solution_free(pkgconf_client_t *client, pkgconf_pkg_t *
 PKGCONF_API pkgconf_pkg_t *pkgconf_cache_lookup(pkgconf_client_t *client, const char *id);
 PKGCONF_API void pkgconf_cache_add(pkgconf_client_t *client, pkgconf_pkg_t *pkg);
 PKGCONF_API void pkgconf_cache_remove(pkgconf_client_t *client, pkgconf_pkg_t *pkg);
+PKGCONF_API void pkgconf_cache_update(pkgconf_client_t *client, pkgconf_pkg_t *pkg);
+PKGCONF_API void pkgconf_cache_set_limits(pkgconf_client_t *client, size_t max_entries, size_t max_bytes);
+PKGCONF_API size_t pkgconf_cache_get_memory(const pkgconf_client_t *client, size_t *entries);
+PKGCONF_API void pkgconf_cache_trim(pkgconf_client_t *client);
+PKGCONF_API bool pkgconf_cache_lookup_miss(pkgconf_client_t *client, const char *id);
+PKGCONF_API void pkgconf_cache_add_miss(pkgconf_client_t *client, const char *id);
 PKGCONF_API void pkgconf_cache_free(pkgconf_client_t *client);
 
+/* compiled.c */
+PKGCONF_API pkgconf_pkg_t *pkgconf_pkg_new_from_compiled(pkgconf_client_t *client, const char *filename, FILE *f, unsigned int flags);
+PKGCONF_API bool pkgconf_pkg_compile(pkgconf_client_t *client, const pkgconf_pkg_t *pkg);
+
+/* dirindex.c */
+#define PKGCONF_DIRINDEX_INSTALLED		0x1
+#define PKGCONF_DIRINDEX_UNINSTALLED		0x2
+#define PKGCONF_DIRINDEX_COMPILED		0x4
+#define PKGCONF_DIRINDEX_UNINSTALLED_COMPILED	0x8
+
+#define PKGCONF_DIRINDEX_FILENAME		".pkgconf-index"
+
+PKGCONF_API bool pkgconf_dirindex_lookup(pkgconf_client_t *client, pkgconf_path_t *pnode, const char *name, unsigned int *flags);
+PKGCONF_API const pkgconf_dirindex_record_t *pkgconf_dirindex_records(pkgconf_client_t *client, pkgconf_path_t *pnode, size_t *count);
+PKGCONF_API bool pkgconf_dirindex_record_provides(pkgconf_client_t *client, const pkgconf_dirindex_record_t *record, const char *package);
+PKGCONF_API bool pkgconf_dirindex_rebuild(pkgconf_client_t *client, const char *path);
+PKGCONF_API uint64_t pkgconf_dirindex_generation(pkgconf_client_t *client, pkgconf_path_t *pnode);
+PKGCONF_API uint64_t pkgconf_dirindex_search_generation(pkgconf_client_t *client);
+PKGCONF_API bool pkgconf_dirindex_refresh(pkgconf_client_t *client, pkgconf_path_t *pnode);
+PKGCONF_API bool pkgconf_dirindex_refresh_search(pkgconf_client_t *client);
+PKGCONF_API void pkgconf_dirindex_free(pkgconf_dirindex_t *index);
+
 /* audit.c */
 PKGCONF_API void pkgconf_audit_set_log(pkgconf_client_t *client, FILE *auditf);
 PKGCONF_API void pkgconf_audit_log(pkgconf_client_t *client, const char *format, ...) PRINTFLIKE(2, 3);
@@ -419,9 +546,12 @@ PKGCONF_API void pkgconf_path_prepend(const char *text, pkgconf_list_t *dirlist,
 PKGCONF_API size_t pkgconf_path_split(const char *text, pkgconf_list_t *dirlist, bool filter);
 PKGCONF_API size_t pkgconf_path_build_from_environ(const char *envvarname, const char *fallback, pkgconf_list_t *dirlist, bool filter);
 PKGCONF_API bool pkgconf_path_match_list(const char *path, const pkgconf_list_t *dirlist);
+PKGCONF_API void pkgconf_path_build_set(pkgconf_list_t *dirlist);
 PKGCONF_API void pkgconf_path_free(pkgconf_list_t *dirlist);
 PKGCONF_API bool pkgconf_path_relocate(char *buf, size_t buflen);
 PKGCONF_API void pkgconf_path_copy_list(pkgconf_list_t *dst, const pkgconf_list_t *src);
+PKGCONF_API int pkgconf_path_dirfd(pkgconf_path_t *pnode);
+PKGCONF_API FILE *pkgconf_path_fopen(pkgconf_path_t *pnode, const char *filename);
 
 #ifdef __cplusplus
 }
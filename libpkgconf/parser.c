@@ -17,90 +17,360 @@
 #include <libpkgconf/stdinc.h>
 #include <libpkgconf/libpkgconf.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+# define PKGCONF_PARSER_SSE2
+# include <emmintrin.h>
+# if defined(__clang__) || __GNUC__ >= 5
+#  define PKGCONF_PARSER_AVX2
+#  include <immintrin.h>
+# endif
+#endif
+
 /*
- * !doc
- *
- * .. c:function:: pkgconf_pkg_t *pkgconf_pkg_new_from_file(const pkgconf_client_t *client, const char *filename, FILE *f)
- *
- *    Parse a .pc file into a pkgconf_pkg_t object structure.
+ * Logical lines are assembled by copying the runs of bytes between the
+ * characters which need attention (line breaks, comments, escapes and NUL
+ * bytes).  Finding the end of a run is the inner loop of the parser, so
+ * it has vector implementations, selected at runtime.
+ */
+typedef const char *(*parser_scan_func_t)(const char *p, const char *end);
+
+static inline bool
+parser_isspecial(unsigned char c)
+{
+	return c == '\n' || c == '\r' || c == '#' || c == '\\' || c == '\0';
+}
+
+static const char *
+parser_scan_scalar(const char *p, const char *end)
+{
+	while (p < end && !parser_isspecial((unsigned char) *p))
+		p++;
+
+	return p;
+}
+
+#ifdef PKGCONF_PARSER_SSE2
+static const char *
+parser_scan_sse2(const char *p, const char *end)
+{
+	const __m128i lf = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+	const __m128i hash = _mm_set1_epi8('#'), bs = _mm_set1_epi8('\\');
+	const __m128i nul = _mm_setzero_si128();
+
+	for (; end - p >= 16; p += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *) p);
+		__m128i m = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)),
+			_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, hash), _mm_cmpeq_epi8(v, bs)),
+				     _mm_cmpeq_epi8(v, nul)));
+		int mask = _mm_movemask_epi8(m);
+
+		if (mask != 0)
+			return p + __builtin_ctz(mask);
+	}
+
+	return parser_scan_scalar(p, end);
+}
+#endif
+
+#ifdef PKGCONF_PARSER_AVX2
+__attribute__((target("avx2")))
+static const char *
+parser_scan_avx2(const char *p, const char *end)
+{
+	const __m256i lf = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+	const __m256i hash = _mm256_set1_epi8('#'), bs = _mm256_set1_epi8('\\');
+	const __m256i nul = _mm256_setzero_si256();
+
+	for (; end - p >= 32; p += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *) p);
+		__m256i m = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr)),
+			_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, hash), _mm256_cmpeq_epi8(v, bs)),
+					_mm256_cmpeq_epi8(v, nul)));
+		unsigned int mask = (unsigned int) _mm256_movemask_epi8(m);
+
+		if (mask != 0)
+			return p + __builtin_ctz(mask);
+	}
+
+	return parser_scan_sse2(p, end);
+}
+#endif
+
+#ifdef PKGCONF_PARSER_AVX2
+/*
+ * The 256-bit units of some CPUs only power up once they are used, so AVX2 pays off
+ * on large files, such as metapackages, but not on the few hundred bytes of a typical
+ * package.
+ */
+#define PARSER_AVX2_MIN_LEN	4096
+
+/* set when the library is loaded, so that parsing threads only ever read it */
+static bool parser_have_avx2 = false;
+
+__attribute__((constructor))
+static void
+parser_detect_cpu(void)
+{
+	__builtin_cpu_init();
+	parser_have_avx2 = __builtin_cpu_supports("avx2");
+}
+#endif
+
+static parser_scan_func_t
+parser_select_scan(size_t len)
+{
+#ifdef PKGCONF_PARSER_AVX2
+	if (parser_have_avx2 && len >= PARSER_AVX2_MIN_LEN)
+		return parser_scan_avx2;
+#else
+	(void) len;
+#endif
+#ifdef PKGCONF_PARSER_SSE2
+	return parser_scan_sse2;
+#else
+	return parser_scan_scalar;
+#endif
+}
+
+static inline bool
+parser_isspace(unsigned char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline bool
+parser_iskeychar(unsigned char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '.';
+}
+
+/*
+ * parser_parse_line(line, end, lineno, data, ops, warnfunc, filename)
  *
- *    :param pkgconf_client_t* client: The pkgconf client object to use for dependency resolution.
- *    :param char* filename: The filename of the package file (including full path).
- *    :param FILE* f: The file object to read from.
- *    :returns: A ``pkgconf_pkg_t`` object which contains the package data.
- *    :rtype: pkgconf_pkg_t *
+ * Split a logical line into key, operator and value, and dispatch it.
+ * `end` points at the NUL terminator of the line.
  */
-void
-pkgconf_parser_parse(FILE *f, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename)
+static void
+parser_parse_line(char *line, char *end, size_t lineno, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename)
 {
-	char readbuf[PKGCONF_BUFSIZE];
-	size_t lineno = 0;
+	char op, *p, *key, *value;
+	bool warned_key_whitespace = false, warned_value_whitespace = false;
 
-	while (pkgconf_fgetline(readbuf, PKGCONF_BUFSIZE, f) != NULL)
+	p = line;
+	while (*p && parser_isspace(*p))
+		p++;
+	if (*p && p != line)
 	{
-		char op, *p, *key, *value;
-		bool warned_key_whitespace = false, warned_value_whitespace = false;
+		warnfunc(data, "%s:" SIZE_FMT_SPECIFIER ": warning: whitespace encountered while parsing key section\n",
+			filename, lineno);
+		warned_key_whitespace = true;
+	}
+	key = p;
+	while (*p && parser_iskeychar(*p))
+		p++;
 
-		lineno++;
+	if (!isalpha((unsigned char)*key) &&
+	    !isdigit((unsigned char)*p))
+		return;
 
-		p = readbuf;
-		while (*p && isspace((unsigned char)*p))
-			p++;
-		if (*p && p != readbuf)
+	while (*p && parser_isspace(*p))
+	{
+		if (!warned_key_whitespace)
 		{
 			warnfunc(data, "%s:" SIZE_FMT_SPECIFIER ": warning: whitespace encountered while parsing key section\n",
 				filename, lineno);
 			warned_key_whitespace = true;
 		}
-		key = p;
-		while (*p && (isalpha((unsigned char)*p) || isdigit((unsigned char)*p) || *p == '_' || *p == '.'))
-			p++;
 
-		if (!isalpha((unsigned char)*key) &&
-		    !isdigit((unsigned char)*p))
-			continue;
+		/* set to null to avoid trailing spaces in key */
+		*p = '\0';
+		p++;
+	}
 
-		while (*p && isspace((unsigned char)*p))
-		{
-			if (!warned_key_whitespace)
-			{
-				warnfunc(data, "%s:" SIZE_FMT_SPECIFIER ": warning: whitespace encountered while parsing key section\n",
-					filename, lineno);
-				warned_key_whitespace = true;
-			}
+	op = *p;
+	if (*p != '\0')
+	{
+		*p = '\0';
+		p++;
+	}
 
-			/* set to null to avoid trailing spaces in key */
-			*p = '\0';
-			p++;
-		}
+	while (*p && parser_isspace(*p))
+		p++;
 
-		op = *p;
-		if (*p != '\0')
+	value = p;
+	p = end - 1;
+	while (p > value && parser_isspace(*p))
+	{
+		if (!warned_value_whitespace && op == '=')
 		{
-			*p = '\0';
-			p++;
+			warnfunc(data, "%s:" SIZE_FMT_SPECIFIER ": warning: trailing whitespace encountered while parsing value section\n",
+				filename, lineno);
+			warned_value_whitespace = true;
 		}
 
-		while (*p && isspace((unsigned char)*p))
-			p++;
+		*p = '\0';
+		p--;
+	}
+	if (ops[(unsigned char) op])
+		ops[(unsigned char) op](data, lineno, key, value);
+}
+
+/*
+ * parser_parse_buffer(scan, buf, len, data, ops, warnfunc, filename)
+ *
+ * Implementation of pkgconf_parser_parse_buffer() using a specific scanner.
+ */
+static void
+parser_parse_buffer(parser_scan_func_t scan, const char *buf, size_t len, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename)
+{
+	char readbuf[PKGCONF_BUFSIZE];
+	char *line = readbuf;
+	const char *p = buf, *end = buf + len;
+	size_t lineno = 0;
+
+	/* a logical line is never longer than the input */
+	if (len >= sizeof readbuf)
+	{
+		line = malloc(len + 1);
+		if (line == NULL)
+			return;
+	}
+
+	while (p < end)
+	{
+		char *s = line;
+		bool quoted = false;
 
-		value = p;
-		p = value + (strlen(value) - 1);
-		while (*p && isspace((unsigned char) *p) && p > value)
+		while (p < end)
 		{
-			if (!warned_value_whitespace && op == '=')
+			const char *run = scan(p, end);
+			char c;
+
+			if (run != p)
 			{
-				warnfunc(data, "%s:" SIZE_FMT_SPECIFIER ": warning: trailing whitespace encountered while parsing value section\n",
-					filename, lineno);
-				warned_value_whitespace = true;
+				if (quoted)
+				{
+					*s++ = '\\';
+					quoted = false;
+				}
+
+				memcpy(s, p, run - p);
+				s += run - p;
+				p = run;
+
+				if (p == end)
+					break;
+			}
+
+			c = *p++;
+
+			if (c == '\\' && !quoted)
+			{
+				quoted = true;
+				continue;
 			}
+			else if (c == '#' && !quoted)
+			{
+				/* skip the rest of the line */
+				const char *eol = memchr(p, '\n', end - p);
 
-			*p = '\0';
-			p--;
+				p = eol != NULL ? eol + 1 : end;
+				break;
+			}
+			else if (c == '\n' || c == '\r')
+			{
+				if (c == '\r' && p < end && *p == '\n')
+					p++;
+
+				if (!quoted)
+					break;
+
+				/* continuation: trim leading blanks of the next line */
+				while (p < end && (*p == ' ' || *p == '\t'))
+					p++;
+
+				quoted = false;
+				continue;
+			}
+			else if (c == '\0')
+			{
+				quoted = false;
+				continue;
+			}
+
+			/* an escaped backslash or '#' */
+			if (c == '\\')
+				*s++ = '\\';
+
+			quoted = false;
+			*s++ = c;
 		}
-		if (ops[(unsigned char) op])
-			ops[(unsigned char) op](data, lineno, key, value);
+
+		*s = '\0';
+		lineno++;
+
+		parser_parse_line(line, s, lineno, data, ops, warnfunc, filename);
 	}
 
+	if (line != readbuf)
+		free(line);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_parser_parse_buffer(const char *buf, size_t len, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename)
+ *
+ *    Parse the contents of an rfc822-style file which has already been read into memory.
+ *    Physical lines are folded into logical lines in the same pass which splits them:
+ *    a backslash before a line break joins the next line (dropping its leading blanks),
+ *    an unescaped ``#`` starts a comment which runs to the end of the line, and ``\r\n``
+ *    and ``\r`` are treated as line breaks.
+ *
+ *    :param char* buf: The file contents.
+ *    :param size_t len: The length of the file contents.
+ *    :param void* data: Opaque data passed to the operand and warning functions.
+ *    :param pkgconf_parser_operand_func_t* ops: A table of handlers, indexed by operator character.
+ *    :param pkgconf_parser_warn_func_t warnfunc: The function used to report warnings.
+ *    :param char* filename: The filename used in warnings.
+ *    :return: nothing
+ */
+void
+pkgconf_parser_parse_buffer(const char *buf, size_t len, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename)
+{
+	parser_parse_buffer(parser_select_scan(len), buf, len, data, ops, warnfunc, filename);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_parser_parse(FILE *f, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename)
+ *
+ *    Read an rfc822-style file and parse it with :c:func:`pkgconf_parser_parse_buffer`.
+ *    The file is closed afterwards.
+ *
+ *    :param FILE* f: The file object to read from.
+ *    :param void* data: Opaque data passed to the operand and warning functions.
+ *    :param pkgconf_parser_operand_func_t* ops: A table of handlers, indexed by operator character.
+ *    :param pkgconf_parser_warn_func_t warnfunc: The function used to report warnings.
+ *    :param char* filename: The filename used in warnings.
+ *    :return: nothing
+ */
+void
+pkgconf_parser_parse(FILE *f, void *data, const pkgconf_parser_operand_func_t *ops, const pkgconf_parser_warn_func_t warnfunc, const char *filename)
+{
+	size_t len;
+	char *buf = pkgconf_freadall(f, &len);
+
 	fclose(f);
+
+	if (buf == NULL)
+		return;
+
+	pkgconf_parser_parse_buffer(buf, len, data, ops, warnfunc, filename);
+	free(buf);
 }
@@ -22,6 +22,138 @@
 # define PKGCONF_CACHE_INODES
 #endif
 
+#ifndef _WIN32
+# include <fcntl.h>
+# define PKGCONF_DIR_DESCRIPTORS
+/* O_PATH descriptors are enough for openat(), and do not need read permission */
+# ifdef O_PATH
+#  define PKGCONF_DIR_OPEN_FLAGS (O_PATH | O_DIRECTORY | O_CLOEXEC)
+# else
+#  define PKGCONF_DIR_OPEN_FLAGS (O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+# endif
+#endif
+
+/* pkgconf_path_t.dir_fd is PATH_DIR_UNOPENED until pkgconf_path_dirfd() has tried to open it */
+#define PATH_DIR_UNOPENED	-1
+#define PATH_DIR_UNAVAILABLE	-2
+
+/*
+ * Path lists which are matched against, such as the client's system directory filters, get a
+ * hashed set of their paths hung off the list's lookup pointer, so that matching a path does not
+ * walk the list.  Paths are normalized when they are added to a list, and the path being matched
+ * is normalized while it is hashed and compared instead of being copied first.  Adding paths
+ * through this module drops the set, and a set which does not account for every entry of the
+ * list is rebuilt on the next match.
+ */
+typedef struct {
+	uint32_t hash;
+	const char *path;
+} path_slot_t;
+
+typedef struct {
+	size_t capacity;
+	size_t length;
+	path_slot_t slots[];
+} path_set_t;
+
+/* a slash which follows another slash is dropped when a path is normalized */
+static inline bool
+path_char_collapsed(const char *path, const char *p)
+{
+	return *p == '/' && p != path && p[-1] == '/';
+}
+
+static uint32_t
+path_hash(const char *path)
+{
+	uint32_t hash = 2166136261U;
+	const char *p;
+
+	for (p = path; *p != '\0'; p++)
+	{
+		if (path_char_collapsed(path, p))
+			continue;
+
+		hash ^= (unsigned char) *p;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+/* compare a normalized path from a list with a path which may not be normalized */
+static bool
+path_equal(const char *normalized, const char *path)
+{
+	const char *p;
+
+	for (p = path; *p != '\0'; p++)
+	{
+		if (path_char_collapsed(path, p))
+			continue;
+
+		if (*normalized++ != *p)
+			return false;
+	}
+
+	return *normalized == '\0';
+}
+
+static path_slot_t *
+path_set_slot(path_set_t *set, const char *path, uint32_t hash)
+{
+	size_t mask = set->capacity - 1;
+	size_t i = hash & mask;
+
+	for (; set->slots[i].path != NULL; i = (i + 1) & mask)
+	{
+		if (set->slots[i].hash == hash && path_equal(set->slots[i].path, path))
+			break;
+	}
+
+	return &set->slots[i];
+}
+
+static void
+path_set_drop(pkgconf_list_t *dirlist)
+{
+	free(dirlist->lookup);
+	dirlist->lookup = NULL;
+}
+
+static path_set_t *
+path_set_build(pkgconf_list_t *dirlist)
+{
+	size_t capacity = 8;
+	path_set_t *set;
+	pkgconf_node_t *n;
+
+	path_set_drop(dirlist);
+
+	while (capacity < dirlist->length * 2)
+		capacity *= 2;
+
+	set = calloc(1, sizeof(path_set_t) + capacity * sizeof(path_slot_t));
+	if (set == NULL)
+		return NULL;
+
+	set->capacity = capacity;
+	set->length = dirlist->length;
+
+	PKGCONF_FOREACH_LIST_ENTRY(dirlist->head, n)
+	{
+		pkgconf_path_t *pnode = n->data;
+		uint32_t hash = path_hash(pnode->path);
+		path_slot_t *slot = path_set_slot(set, pnode->path, hash);
+
+		slot->hash = hash;
+		slot->path = pnode->path;
+	}
+
+	dirlist->lookup = set;
+	return set;
+}
+
 static bool
 #ifdef PKGCONF_CACHE_INODES
 path_list_contains_entry(const char *text, pkgconf_list_t *dirlist, struct stat *st)
@@ -92,6 +224,7 @@ prepare_path_node(const char *text, pkgconf_list_t *dirlist, bool filter)
 
 	node = calloc(1, sizeof(pkgconf_path_t));
 	node->path = strdup(path);
+	node->dir_fd = PATH_DIR_UNOPENED;
 
 #ifdef PKGCONF_CACHE_INODES
 	if (filter) {
@@ -122,6 +255,7 @@ pkgconf_path_add(const char *text, pkgconf_list_t *dirlist, bool filter)
 	if (node == NULL)
 		return;
 
+	path_set_drop(dirlist);
 	pkgconf_node_insert_tail(&node->lnode, node, dirlist);
 }
 
@@ -144,6 +278,7 @@ pkgconf_path_prepend(const char *text, pkgconf_list_t *dirlist, bool filter)
 	if (node == NULL)
 		return;
 
+	path_set_drop(dirlist);
 	pkgconf_node_insert(&node->lnode, node, dirlist);
 }
 
@@ -227,25 +362,45 @@ pkgconf_path_build_from_environ(const char *envvarname, const char *fallback, pk
 bool
 pkgconf_path_match_list(const char *path, const pkgconf_list_t *dirlist)
 {
-	pkgconf_node_t *n = NULL;
-	char relocated[PKGCONF_ITEM_SIZE];
-	const char *cpath = path;
+	path_set_t *set = dirlist->lookup;
+	pkgconf_node_t *n;
 
-	pkgconf_strlcpy(relocated, path, sizeof relocated);
-	if (pkgconf_path_relocate(relocated, sizeof relocated))
-		cpath = relocated;
+	/* the set is a cache of the list's contents, so it may be built for a list passed as const */
+	if (set == NULL || set->length != dirlist->length)
+		set = path_set_build((pkgconf_list_t *) dirlist);
+
+	if (set != NULL)
+		return path_set_slot(set, path, path_hash(path))->path != NULL;
 
 	PKGCONF_FOREACH_LIST_ENTRY(dirlist->head, n)
 	{
 		pkgconf_path_t *pnode = n->data;
 
-		if (!strcmp(pnode->path, cpath))
+		if (path_equal(pnode->path, path))
 			return true;
 	}
 
 	return false;
 }
 
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_path_build_set(pkgconf_list_t *dirlist)
+ *
+ *    Builds the hashed set of paths which :c:func:`pkgconf_path_match_list` uses for a path list,
+ *    instead of leaving it to the first match.  Lists which are matched against from several
+ *    threads should have their set built beforehand.
+ *
+ *    :param pkgconf_list_t* dirlist: The path list to build the set for.
+ *    :return: nothing
+ */
+void
+pkgconf_path_build_set(pkgconf_list_t *dirlist)
+{
+	path_set_build(dirlist);
+}
+
 /*
  * !doc
  *
@@ -268,6 +423,7 @@ pkgconf_path_copy_list(pkgconf_list_t *dst, const pkgconf_list_t *src)
 
 		path = calloc(1, sizeof(pkgconf_path_t));
 		path->path = strdup(srcpath->path);
+		path->dir_fd = PATH_DIR_UNOPENED;
 
 #ifdef PKGCONF_CACHE_INODES
 		path->handle_path = srcpath->handle_path;
@@ -276,6 +432,7 @@ pkgconf_path_copy_list(pkgconf_list_t *dst, const pkgconf_list_t *src)
 
 		pkgconf_node_insert_tail(&path->lnode, path, dst);
 	}
+	path_set_drop(dst);
 }
 
 /*
@@ -297,13 +454,96 @@ pkgconf_path_free(pkgconf_list_t *dirlist)
 	{
 		pkgconf_path_t *pnode = n->data;
 
+		pkgconf_dirindex_free(pnode->index);
+#ifdef PKGCONF_DIR_DESCRIPTORS
+		if (pnode->dir_fd >= 0)
+			close(pnode->dir_fd);
+#endif
 		free(pnode->path);
 		free(pnode);
 	}
 
+	path_set_drop(dirlist);
 	pkgconf_list_zero(dirlist);
 }
 
+/*
+ * !doc
+ *
+ * .. c:function:: int pkgconf_path_dirfd(pkgconf_path_t *pnode)
+ *
+ *    Returns a descriptor for the directory of a path node, opening it the first time it is
+ *    asked for.  Files in the directory can then be opened with ``openat()`` without the
+ *    kernel resolving the directory path again.  The descriptor belongs to the path node
+ *    and is closed by :c:func:`pkgconf_path_free`.
+ *
+ *    Path nodes are not locked, so a descriptor which may be asked for from several threads
+ *    must be opened beforehand.
+ *
+ *    :param pkgconf_path_t* pnode: The path node to open.
+ *    :return: the directory descriptor, or -1 if the directory could not be opened or the platform has no ``openat()``.
+ *    :rtype: int
+ */
+int
+pkgconf_path_dirfd(pkgconf_path_t *pnode)
+{
+#ifdef PKGCONF_DIR_DESCRIPTORS
+	if (pnode->dir_fd == PATH_DIR_UNOPENED)
+	{
+		pnode->dir_fd = open(pnode->path, PKGCONF_DIR_OPEN_FLAGS);
+		if (pnode->dir_fd < 0)
+			pnode->dir_fd = PATH_DIR_UNAVAILABLE;
+	}
+
+	return pnode->dir_fd >= 0 ? pnode->dir_fd : -1;
+#else
+	(void) pnode;
+
+	return -1;
+#endif
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: FILE *pkgconf_path_fopen(pkgconf_path_t *pnode, const char *filename)
+ *
+ *    Opens a file in the directory of a path node for reading, relative to the directory
+ *    descriptor if there is one.
+ *
+ *    :param pkgconf_path_t* pnode: The path node to open the file in.
+ *    :param char* filename: The name of the file within the directory.
+ *    :return: the opened file, or ``NULL`` if it could not be opened.
+ *    :rtype: FILE *
+ */
+FILE *
+pkgconf_path_fopen(pkgconf_path_t *pnode, const char *filename)
+{
+	char pathbuf[PKGCONF_ITEM_SIZE];
+
+#ifdef PKGCONF_DIR_DESCRIPTORS
+	int dirfd = pkgconf_path_dirfd(pnode);
+
+	if (dirfd >= 0)
+	{
+		FILE *f;
+		int fd = openat(dirfd, filename, O_RDONLY | O_CLOEXEC);
+
+		if (fd < 0)
+			return NULL;
+
+		if ((f = fdopen(fd, "r")) == NULL)
+			close(fd);
+
+		return f;
+	}
+#endif
+
+	snprintf(pathbuf, sizeof pathbuf, "%s%c%s", pnode->path, PKG_DIR_SEP_S, filename);
+
+	return fopen(pathbuf, "r");
+}
+
 static char *
 normpath(const char *path)
 {
@@ -250,6 +250,8 @@ load_personality_with_path(const char *path, const char *triplet, bool datadir)
 {
 	char pathbuf[PKGCONF_ITEM_SIZE];
 	FILE *f;
+	char *buf;
+	size_t len;
 	pkgconf_cross_personality_t *p;
 
 	/* if triplet is null, assume that path is a direct path to the personality file */
@@ -264,10 +266,16 @@ load_personality_with_path(const char *path, const char *triplet, bool datadir)
 	if (f == NULL)
 		return NULL;
 
+	buf = pkgconf_freadall(f, &len);
+	fclose(f);
+	if (buf == NULL)
+		return NULL;
+
 	p = calloc(1, sizeof(pkgconf_cross_personality_t));
 	if (triplet != NULL)
 		p->name = strdup(triplet);
-	pkgconf_parser_parse(f, p, personality_parser_ops, personality_warn_func, pathbuf);
+	pkgconf_parser_parse_buffer(buf, len, p, personality_parser_ops, personality_warn_func, pathbuf);
+	free(buf);
 
 	return p;
 }
@@ -17,6 +17,16 @@
 #include <libpkgconf/stdinc.h>
 #include <libpkgconf/libpkgconf.h>
 
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+# define PKGCONF_PARALLEL_SCAN
+#endif
+
+#ifndef _WIN32
+# include <fcntl.h>
+# define PKGCONF_OPENAT
+#endif
+
 /*
  * !doc
  *
@@ -121,7 +131,7 @@ pkgconf_pkg_parser_version_func(pkgconf_client_t *client, pkgconf_pkg_t *pkg, co
 }
 
 static void
-pkgconf_pkg_parser_fragment_func(pkgconf_client_t *client, pkgconf_pkg_t *pkg, const char *keyword, const size_t lineno, const ptrdiff_t offset, const char *value)
+pkgconf_pkg_parse_fragment_field(pkgconf_client_t *client, pkgconf_pkg_t *pkg, const char *keyword, const size_t lineno, const ptrdiff_t offset, const char *value)
 {
 	pkgconf_list_t *dest = (pkgconf_list_t *)((char *) pkg + offset);
 	bool ret = pkgconf_fragment_parse(client, dest, &pkg->vars, value, pkg->flags);
@@ -133,6 +143,97 @@ pkgconf_pkg_parser_fragment_func(pkgconf_client_t *client, pkgconf_pkg_t *pkg, c
 	}
 }
 
+/* a fragment field whose parsing was deferred by PKGCONF_PKG_PKGF_DEFER_FRAGMENTS */
+typedef struct {
+	pkgconf_node_t iter;
+	char *keyword;
+	size_t lineno;
+	ptrdiff_t offset;
+	char *value;
+} pkgconf_pkg_deferred_field_t;
+
+static void
+pkgconf_pkg_deferred_free(pkgconf_pkg_t *pkg)
+{
+	pkgconf_node_t *n, *tn;
+
+	PKGCONF_FOREACH_LIST_ENTRY_SAFE(pkg->deferred.head, tn, n)
+	{
+		pkgconf_pkg_deferred_field_t *field = n->data;
+
+		free(field->keyword);
+		free(field->value);
+		free(field);
+	}
+
+	pkgconf_list_zero(&pkg->deferred);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_pkg_load_fragments(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
+ *
+ *    Parses the ``Cflags`` and ``Libs`` fields of a package which was loaded with the
+ *    ``PKGCONF_PKG_PKGF_DEFER_FRAGMENTS`` client flag set.  The fields are parsed as they would
+ *    have been while loading the package, so the fragment lists are the same either way.
+ *    Functions in this module which collect fragments call this themselves, so it is only
+ *    needed to access the fragment lists of a package directly.
+ *
+ *    :param pkgconf_client_t* client: The client object the package belongs to.
+ *    :param pkgconf_pkg_t* pkg: The package whose fragment fields should be parsed.
+ *    :return: nothing
+ */
+void
+pkgconf_pkg_load_fragments(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
+{
+	pkgconf_node_t *n;
+
+	if (pkg->deferred.head == NULL)
+		return;
+
+	PKGCONF_TRACE(client, "parsing deferred fragments of %s", pkg->id);
+
+	PKGCONF_FOREACH_LIST_ENTRY(pkg->deferred.head, n)
+	{
+		pkgconf_pkg_deferred_field_t *field = n->data;
+
+		pkgconf_pkg_parse_fragment_field(client, pkg, field->keyword, field->lineno, field->offset, field->value);
+	}
+
+	pkgconf_pkg_deferred_free(pkg);
+	pkgconf_cache_update(client, pkg);
+}
+
+static void
+pkgconf_pkg_parser_fragment_func(pkgconf_client_t *client, pkgconf_pkg_t *pkg, const char *keyword, const size_t lineno, const ptrdiff_t offset, const char *value)
+{
+	pkgconf_pkg_deferred_field_t *field;
+
+	if (!(client->flags & PKGCONF_PKG_PKGF_DEFER_FRAGMENTS) || (field = calloc(1, sizeof(*field))) == NULL)
+	{
+		pkgconf_pkg_parse_fragment_field(client, pkg, keyword, lineno, offset, value);
+		return;
+	}
+
+	field->keyword = strdup(keyword);
+	field->lineno = lineno;
+	field->offset = offset;
+	field->value = strdup(value);
+
+	if (field->keyword == NULL || field->value == NULL)
+	{
+		free(field->keyword);
+		free(field->value);
+		free(field);
+
+		pkgconf_pkg_parse_fragment_field(client, pkg, keyword, lineno, offset, value);
+		return;
+	}
+
+	pkgconf_node_insert_tail(&field->iter, field, &pkg->deferred);
+}
+
 static void
 pkgconf_pkg_parser_dependency_func(pkgconf_client_t *client, pkgconf_pkg_t *pkg, const char *keyword, const size_t lineno, const ptrdiff_t offset, const char *value)
 {
@@ -305,6 +406,16 @@ is_path_prefix_equal(const char *path1, const char *path2, size_t path2_len)
 #endif
 }
 
+/* variables are only expanded when something needs them if PKGCONF_PKG_PKGF_DEFER_VARIABLES is set */
+static void
+pkgconf_pkg_parser_add_var(pkgconf_pkg_t *pkg, const char *keyword, const char *value)
+{
+	if (pkg->owner->flags & PKGCONF_PKG_PKGF_DEFER_VARIABLES)
+		pkgconf_tuple_add_deferred(pkg->owner, &pkg->vars, keyword, value, pkg->flags);
+	else
+		pkgconf_tuple_add(pkg->owner, &pkg->vars, keyword, value, true, pkg->flags);
+}
+
 static void
 pkgconf_pkg_parser_value_set(void *opaque, const size_t lineno, const char *keyword, const char *value)
 {
@@ -313,6 +424,9 @@ pkgconf_pkg_parser_value_set(void *opaque, const size_t lineno, const char *keyw
 
 	(void) lineno;
 
+	/* deferred fields must be expanded against the variables defined before them */
+	pkgconf_pkg_load_fragments(pkg->owner, pkg);
+
 	pkgconf_strlcpy(canonicalized_value, value, sizeof canonicalized_value);
 	canonicalize_path(canonicalized_value);
 
@@ -329,8 +443,8 @@ pkgconf_pkg_parser_value_set(void *opaque, const size_t lineno, const char *keyw
 		pkgconf_strlcat(newvalue, canonicalized_value + strlen(pkg->orig_prefix->value), sizeof newvalue);
 		pkgconf_tuple_add(pkg->owner, &pkg->vars, keyword, newvalue, false, pkg->flags);
 	}
-	else if (strcmp(keyword, pkg->owner->prefix_varname) || !(pkg->owner->flags & PKGCONF_PKG_PKGF_REDEFINE_PREFIX))
-		pkgconf_tuple_add(pkg->owner, &pkg->vars, keyword, value, true, pkg->flags);
+	else if (!(pkg->owner->flags & PKGCONF_PKG_PKGF_REDEFINE_PREFIX) || strcmp(keyword, pkg->owner->prefix_varname))
+		pkgconf_pkg_parser_add_var(pkg, keyword, value);
 	else
 	{
 		char pathbuf[PKGCONF_ITEM_SIZE];
@@ -344,7 +458,7 @@ pkgconf_pkg_parser_value_set(void *opaque, const size_t lineno, const char *keyw
 			free(prefix_value);
 		}
 		else
-			pkgconf_tuple_add(pkg->owner, &pkg->vars, keyword, value, true, pkg->flags);
+			pkgconf_pkg_parser_add_var(pkg, keyword, value);
 	}
 }
 
@@ -417,7 +531,8 @@ pkgconf_pkg_t *
 pkgconf_pkg_new_from_file(pkgconf_client_t *client, const char *filename, FILE *f, unsigned int flags)
 {
 	pkgconf_pkg_t *pkg;
-	char *idptr;
+	char *idptr, *buf;
+	size_t len;
 
 	pkg = calloc(1, sizeof(pkgconf_pkg_t));
 	pkg->owner = client;
@@ -433,7 +548,7 @@ pkgconf_pkg_new_from_file(pkgconf_client_t *client, const char *filename, FILE *
 	 * package.
 	 * See https://github.com/pkgconf/pkgconf/issues/213
 	 */
-	if (client->sysroot_dir && strncmp(pkg->pc_filedir, client->sysroot_dir, strlen(client->sysroot_dir)))
+	if (client->paths.sysroot_dir && strncmp(pkg->pc_filedir, client->paths.sysroot_dir, client->paths.sysroot_len))
 		pkgconf_tuple_add(client, &pkg->vars, "pc_sysrootdir", "", false, pkg->flags);
 
 	/* make module id */
@@ -464,7 +579,17 @@ pkgconf_pkg_new_from_file(pkgconf_client_t *client, const char *filename, FILE *
 			*idptr = '\0';
 	}
 
-	pkgconf_parser_parse(f, pkg, pkg_parser_funcs, (pkgconf_parser_warn_func_t) pkg_warn_func, pkg->filename);
+	buf = pkgconf_freadall(f, &len);
+	fclose(f);
+
+	if (buf != NULL)
+	{
+		client->stats.files_parsed++;
+		client->stats.bytes_read += len;
+
+		pkgconf_parser_parse_buffer(buf, len, pkg, pkg_parser_funcs, (pkgconf_parser_warn_func_t) pkg_warn_func, pkg->filename);
+		free(buf);
+	}
 
 	if (!pkgconf_pkg_validate(client, pkg))
 	{
@@ -510,6 +635,7 @@ pkgconf_pkg_free(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
 	pkgconf_fragment_free(&pkg->cflags_private);
 	pkgconf_fragment_free(&pkg->libs);
 	pkgconf_fragment_free(&pkg->libs_private);
+	pkgconf_pkg_deferred_free(pkg);
 
 	pkgconf_tuple_free(&pkg->vars);
 
@@ -600,229 +726,954 @@ pkgconf_pkg_unref(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
 		pkgconf_pkg_free(pkg->owner, pkg);
 }
 
+/*
+ * pkgconf_pkg_load_file(client, filename, f, flags, compiled)
+ *
+ * load a package from an opened .pc file, preferring its compiled form if `compiled` is set.
+ */
+static pkgconf_pkg_t *
+pkgconf_pkg_load_file(pkgconf_client_t *client, const char *filename, FILE *f, unsigned int flags, bool compiled)
+{
+	pkgconf_pkg_t *pkg;
+
+	client->stats.files_opened++;
+
+	if (compiled && (pkg = pkgconf_pkg_new_from_compiled(client, filename, f, flags)) != NULL)
+	{
+		fclose(f);
+		return pkg;
+	}
+
+	return pkgconf_pkg_new_from_file(client, filename, f, flags);
+}
+
+/*
+ * pkgconf_pkg_open_specific_path(pnode, path, filename, buf, buflen)
+ *
+ * open `filename` in a search directory.  with a path node, the file is opened relative to
+ * the directory descriptor, and the full path only gets written to `buf` once it was found.
+ */
+static FILE *
+pkgconf_pkg_open_specific_path(pkgconf_path_t *pnode, const char *path, const char *filename, char *buf, size_t buflen)
+{
+	FILE *f;
+
+	if (pnode == NULL)
+	{
+		snprintf(buf, buflen, "%s%c%s", path, PKG_DIR_SEP_S, filename);
+		return fopen(buf, "r");
+	}
+
+	if ((f = pkgconf_path_fopen(pnode, filename)) != NULL)
+		snprintf(buf, buflen, "%s%c%s", path, PKG_DIR_SEP_S, filename);
+
+	return f;
+}
+
 static inline pkgconf_pkg_t *
-pkgconf_pkg_try_specific_path(pkgconf_client_t *client, const char *path, const char *name)
+pkgconf_pkg_try_specific_path(pkgconf_client_t *client, pkgconf_path_t *pnode, const char *path, const char *name)
 {
 	pkgconf_pkg_t *pkg = NULL;
 	FILE *f;
+	char filename[PKGCONF_ITEM_SIZE];
 	char locbuf[PKGCONF_ITEM_SIZE];
-	char uninst_locbuf[PKGCONF_ITEM_SIZE];
+	unsigned int present = PKGCONF_DIRINDEX_INSTALLED | PKGCONF_DIRINDEX_UNINSTALLED |
+		PKGCONF_DIRINDEX_COMPILED | PKGCONF_DIRINDEX_UNINSTALLED_COMPILED;
 
 	PKGCONF_TRACE(client, "trying path: %s for %s", path, name);
 
-	snprintf(locbuf, sizeof locbuf, "%s%c%s" PKG_CONFIG_EXT, path, PKG_DIR_SEP_S, name);
-	snprintf(uninst_locbuf, sizeof uninst_locbuf, "%s%c%s-uninstalled" PKG_CONFIG_EXT, path, PKG_DIR_SEP_S, name);
+	/* consult the directory snapshot, if we have one, so that only files which exist get opened */
+	if (pnode != NULL && pkgconf_dirindex_lookup(client, pnode, name, &present) && !present)
+		return NULL;
 
-	if (!(client->flags & PKGCONF_PKG_PKGF_NO_UNINSTALLED) && (f = fopen(uninst_locbuf, "r")) != NULL)
+	if (!(client->flags & PKGCONF_PKG_PKGF_NO_UNINSTALLED) && (present & PKGCONF_DIRINDEX_UNINSTALLED))
 	{
-		PKGCONF_TRACE(client, "found (uninstalled): %s", uninst_locbuf);
-		pkg = pkgconf_pkg_new_from_file(client, uninst_locbuf, f, PKGCONF_PKG_PROPF_UNINSTALLED);
+		snprintf(filename, sizeof filename, "%s-uninstalled" PKG_CONFIG_EXT, name);
+
+		if ((f = pkgconf_pkg_open_specific_path(pnode, path, filename, locbuf, sizeof locbuf)) != NULL)
+		{
+			PKGCONF_TRACE(client, "found (uninstalled): %s", locbuf);
+			return pkgconf_pkg_load_file(client, locbuf, f, PKGCONF_PKG_PROPF_UNINSTALLED, present & PKGCONF_DIRINDEX_UNINSTALLED_COMPILED);
+		}
 	}
-	else if ((f = fopen(locbuf, "r")) != NULL)
+
+	if (present & PKGCONF_DIRINDEX_INSTALLED)
 	{
-		PKGCONF_TRACE(client, "found: %s", locbuf);
-		pkg = pkgconf_pkg_new_from_file(client, locbuf, f, 0);
+		snprintf(filename, sizeof filename, "%s" PKG_CONFIG_EXT, name);
+
+		if ((f = pkgconf_pkg_open_specific_path(pnode, path, filename, locbuf, sizeof locbuf)) != NULL)
+		{
+			PKGCONF_TRACE(client, "found: %s", locbuf);
+			pkg = pkgconf_pkg_load_file(client, locbuf, f, 0, present & PKGCONF_DIRINDEX_COMPILED);
+		}
 	}
 
 	return pkg;
 }
 
+/*
+ * pkgconf_pkg_scan_load(client, pnode, filename)
+ *
+ * load the package in file `filename` of a search directory, if it is a .pc file.
+ */
 static pkgconf_pkg_t *
-pkgconf_pkg_scan_dir(pkgconf_client_t *client, const char *path, void *data, pkgconf_pkg_iteration_func_t func)
+pkgconf_pkg_scan_load(pkgconf_client_t *client, pkgconf_path_t *pnode, const char *filename)
 {
-	DIR *dir;
-	struct dirent *dirent;
-	pkgconf_pkg_t *outpkg = NULL;
+	const char *path = pnode->path;
+	char filebuf[PKGCONF_ITEM_SIZE];
+	char idbuf[PKGCONF_ITEM_SIZE];
+	unsigned int present = PKGCONF_DIRINDEX_COMPILED;
+	FILE *f;
 
-	dir = opendir(path);
-	if (dir == NULL)
+	if (!str_has_suffix(filename, PKG_CONFIG_EXT))
 		return NULL;
 
-	PKGCONF_TRACE(client, "scanning dir [%s]", path);
+	pkgconf_strlcpy(filebuf, path, sizeof filebuf);
+	pkgconf_strlcat(filebuf, "/", sizeof filebuf);
+	pkgconf_strlcat(filebuf, filename, sizeof filebuf);
 
-	for (dirent = readdir(dir); dirent != NULL; dirent = readdir(dir))
+	PKGCONF_TRACE(client, "trying file [%s]", filebuf);
+
+	f = pkgconf_path_fopen(pnode, filename);
+	if (f == NULL)
+		return NULL;
+
+	/* only look for a compiled form if the directory snapshot says there is one */
+	pkgconf_strlcpy(idbuf, filename, sizeof idbuf);
+	idbuf[strlen(idbuf) - strlen(PKG_CONFIG_EXT)] = '\0';
+	pkgconf_dirindex_lookup(client, pnode, idbuf, &present);
+
+	return pkgconf_pkg_load_file(client, filebuf, f, 0, present & PKGCONF_DIRINDEX_COMPILED);
+}
+
+/*
+ * pkgconf_pkg_scan_consume(client, pkg, data, func, outpkg)
+ *
+ * hand a loaded package to the iteration function.  returns true if iteration should stop.
+ */
+static bool
+pkgconf_pkg_scan_consume(pkgconf_client_t *client, pkgconf_pkg_t *pkg, void *data, pkgconf_pkg_iteration_func_t func, pkgconf_pkg_t **outpkg)
+{
+	if (pkg == NULL)
+		return false;
+
+	if (func(pkg, data))
 	{
-		char filebuf[PKGCONF_ITEM_SIZE];
-		pkgconf_pkg_t *pkg;
-		FILE *f;
+		*outpkg = pkg;
+		return true;
+	}
 
-		pkgconf_strlcpy(filebuf, path, sizeof filebuf);
-		pkgconf_strlcat(filebuf, "/", sizeof filebuf);
-		pkgconf_strlcat(filebuf, dirent->d_name, sizeof filebuf);
+	pkgconf_pkg_unref(client, pkg);
+	return false;
+}
 
-		if (!str_has_suffix(filebuf, PKG_CONFIG_EXT))
-			continue;
+#ifdef PKGCONF_PARALLEL_SCAN
+/*
+ * A parallel scan loads the packages of a directory on a pool of worker threads, while the
+ * calling thread hands them to the iteration function in directory order.  Workers load
+ * packages through a private copy of the client whose handlers record messages on the job
+ * instead of reporting them.  The messages are replayed to the real handlers when the job
+ * is consumed, so callers observe the same sequence of events as with a serial scan.
+ * The same pool loads modules by name for pkgconf_cache_preload().
+ */
+typedef pkgconf_pkg_t *(*pkgconf_scan_load_func_t)(pkgconf_client_t *client, pkgconf_path_t *pnode, const char *name);
+typedef bool (*pkgconf_scan_consume_func_t)(pkgconf_client_t *client, pkgconf_pkg_t *pkg, void *data);
 
-		PKGCONF_TRACE(client, "trying file [%s]", filebuf);
+typedef enum {
+	PKGCONF_SCAN_MSG_ERROR,
+	PKGCONF_SCAN_MSG_WARN,
+	PKGCONF_SCAN_MSG_TRACE,
+} pkgconf_scan_msg_kind_t;
 
-		f = fopen(filebuf, "r");
-		if (f == NULL)
-			continue;
+typedef struct {
+	pkgconf_node_t iter;
+	pkgconf_scan_msg_kind_t kind;
+	char msg[];
+} pkgconf_scan_msg_t;
 
-		pkg = pkgconf_pkg_new_from_file(client, filebuf, f, 0);
-		if (pkg != NULL)
+typedef struct {
+	const char *name;
+	pkgconf_pkg_t *pkg;
+	pkgconf_list_t messages;
+	bool done;
+} pkgconf_scan_job_t;
+
+typedef struct {
+	pkgconf_client_t *client;
+	pkgconf_path_t *pnode;
+	pkgconf_scan_load_func_t load;
+	pkgconf_scan_job_t *jobs;
+	size_t count;
+	size_t next;
+	bool cancel;
+	pkgconf_client_stats_t stats;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} pkgconf_scan_pool_t;
+
+/* workers count into a client of their own, whose counters are added up afterwards */
+static void
+pkgconf_scan_merge_stats(pkgconf_client_stats_t *dst, const pkgconf_client_stats_t *src)
+{
+	dst->cache_hits += src->cache_hits;
+	dst->cache_misses += src->cache_misses;
+	dst->files_opened += src->files_opened;
+	dst->files_parsed += src->files_parsed;
+	dst->bytes_read += src->bytes_read;
+	dst->provider_scans += src->provider_scans;
+	dst->traversal_visits += src->traversal_visits;
+}
+
+static bool
+pkgconf_scan_capture(pkgconf_scan_job_t *job, pkgconf_scan_msg_kind_t kind, const char *msg)
+{
+	size_t len = strlen(msg) + 1;
+	pkgconf_scan_msg_t *m = calloc(1, sizeof(pkgconf_scan_msg_t) + len);
+
+	if (m == NULL)
+		return false;
+
+	m->kind = kind;
+	memcpy(m->msg, msg, len);
+	pkgconf_node_insert_tail(&m->iter, m, &job->messages);
+
+	return true;
+}
+
+static bool
+pkgconf_scan_capture_error(const char *msg, const pkgconf_client_t *client, void *data)
+{
+	(void) client;
+
+	return pkgconf_scan_capture(data, PKGCONF_SCAN_MSG_ERROR, msg);
+}
+
+static bool
+pkgconf_scan_capture_warn(const char *msg, const pkgconf_client_t *client, void *data)
+{
+	(void) client;
+
+	return pkgconf_scan_capture(data, PKGCONF_SCAN_MSG_WARN, msg);
+}
+
+static bool
+pkgconf_scan_capture_trace(const char *msg, const pkgconf_client_t *client, void *data)
+{
+	(void) client;
+
+	return pkgconf_scan_capture(data, PKGCONF_SCAN_MSG_TRACE, msg);
+}
+
+/*
+ * pkgconf_scan_job_finish(client, job, replay)
+ *
+ * release the messages recorded while loading a job, replaying them to the client's handlers
+ * first if `replay` is set.
+ */
+static void
+pkgconf_scan_job_finish(pkgconf_client_t *client, pkgconf_scan_job_t *job, bool replay)
+{
+	pkgconf_node_t *n, *tn;
+
+	PKGCONF_FOREACH_LIST_ENTRY_SAFE(job->messages.head, tn, n)
+	{
+		pkgconf_scan_msg_t *m = n->data;
+
+		if (replay)
 		{
-			if (func(pkg, data))
+			switch (m->kind)
 			{
-				outpkg = pkg;
-				goto out;
+			case PKGCONF_SCAN_MSG_ERROR:
+				client->error_handler(m->msg, client, client->error_handler_data);
+				break;
+			case PKGCONF_SCAN_MSG_WARN:
+				client->warn_handler(m->msg, client, client->warn_handler_data);
+				break;
+			case PKGCONF_SCAN_MSG_TRACE:
+				if (client->trace_handler != NULL)
+					client->trace_handler(m->msg, client, client->trace_handler_data);
+				break;
 			}
-
-			pkgconf_pkg_unref(client, pkg);
 		}
+
+		free(m);
 	}
 
-out:
-	closedir(dir);
-	return outpkg;
+	job->messages.head = job->messages.tail = NULL;
+	job->messages.length = 0;
 }
 
 /*
- * !doc
- *
- * .. c:function:: pkgconf_pkg_t *pkgconf_scan_all(pkgconf_client_t *client, void *data, pkgconf_pkg_iteration_func_t func)
- *
- *    Iterates over all packages found in the `package directory list`, running ``func`` on them.  If ``func`` returns true,
- *    then stop iteration and return the last iterated package.
+ * pkgconf_scan_adopt(client, pkg)
  *
- *    :param pkgconf_client_t* client: The pkgconf client object to use for dependency resolution.
- *    :param void* data: An opaque pointer to data to provide the iteration function with.
- *    :param pkgconf_pkg_iteration_func_t func: A function which is called for each package to determine if the package matches,
- *        always return ``false`` to iterate over all packages.
- *    :return: A package object reference if one is found by the scan function, else ``NULL``.
- *    :rtype: pkgconf_pkg_t *
+ * transfer a package loaded by a worker to the client it was loaded on behalf of.
  */
-pkgconf_pkg_t *
-pkgconf_scan_all(pkgconf_client_t *client, void *data, pkgconf_pkg_iteration_func_t func)
+static void
+pkgconf_scan_adopt(pkgconf_client_t *client, pkgconf_pkg_t *pkg)
 {
+	pkgconf_list_t *lists[] = { &pkg->required, &pkg->requires_private, &pkg->conflicts, &pkg->provides };
 	pkgconf_node_t *n;
-	pkgconf_pkg_t *pkg;
+	size_t i;
 
-	PKGCONF_FOREACH_LIST_ENTRY(client->dir_list.head, n)
+	pkg->owner = client;
+
+	for (i = 0; i < PKGCONF_ARRAY_SIZE(lists); i++)
 	{
-		pkgconf_path_t *pnode = n->data;
+		PKGCONF_FOREACH_LIST_ENTRY(lists[i]->head, n)
+		{
+			pkgconf_dependency_t *dep = n->data;
 
-		PKGCONF_TRACE(client, "scanning directory: %s", pnode->path);
+			dep->owner = client;
+		}
+	}
+}
 
-		if ((pkg = pkgconf_pkg_scan_dir(client, pnode->path, data, func)) != NULL)
-			return pkg;
+static void *
+pkgconf_scan_worker(void *arg)
+{
+	pkgconf_scan_pool_t *pool = arg;
+	pkgconf_client_t wclient = *pool->client;
+
+	memset(&wclient.stats, 0, sizeof wclient.stats);
+	wclient.error_handler = pkgconf_scan_capture_error;
+	wclient.warn_handler = pkgconf_scan_capture_warn;
+	if (wclient.trace_handler != NULL)
+		wclient.trace_handler = pkgconf_scan_capture_trace;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	while (!pool->cancel && pool->next < pool->count)
+	{
+		pkgconf_scan_job_t *job = &pool->jobs[pool->next++];
+		pkgconf_pkg_t *pkg;
+
+		pthread_mutex_unlock(&pool->mutex);
+
+		wclient.error_handler_data = job;
+		wclient.warn_handler_data = job;
+		wclient.trace_handler_data = job;
+
+		pkg = pool->load(&wclient, pool->pnode, job->name);
+		if (pkg != NULL)
+			pkgconf_scan_adopt(pool->client, pkg);
+
+		pthread_mutex_lock(&pool->mutex);
+
+		job->pkg = pkg;
+		job->done = true;
+		pthread_cond_broadcast(&pool->cond);
 	}
 
+	pkgconf_scan_merge_stats(&pool->stats, &wclient.stats);
+
+	pthread_mutex_unlock(&pool->mutex);
+
 	return NULL;
 }
 
-#ifdef _WIN32
-static pkgconf_pkg_t *
-pkgconf_pkg_find_in_registry_key(pkgconf_client_t *client, HKEY hkey, const char *name)
+/*
+ * pkgconf_pkg_scan_parallel(client, pnode, load, names, count, consume, data)
+ *
+ * load the packages in `names` with `load` on a worker pool, and hand them to `consume` in
+ * order until it returns true.  `consume` takes over the reference to each package.
+ * returns false if the pool could not be started, in which case nothing has been done.
+ */
+static bool
+pkgconf_pkg_scan_parallel(pkgconf_client_t *client, pkgconf_path_t *pnode, pkgconf_scan_load_func_t load, const char **names, size_t count, pkgconf_scan_consume_func_t consume, void *data)
 {
-	pkgconf_pkg_t *pkg = NULL;
+	pkgconf_scan_pool_t pool = {
+		.client = client,
+		.pnode = pnode,
+		.load = load,
+		.count = count,
+	};
+	pthread_t *threads;
+	size_t nthreads = client->scan_workers, started = 0, i;
+	bool stop = false;
+
+	if (nthreads > count)
+		nthreads = count;
+
+	pool.jobs = calloc(count, sizeof(pkgconf_scan_job_t));
+	threads = calloc(nthreads, sizeof(pthread_t));
+	if (pool.jobs == NULL || threads == NULL)
+	{
+		free(pool.jobs);
+		free(threads);
+		return false;
+	}
+
+	for (i = 0; i < count; i++)
+		pool.jobs[i].name = names[i];
+
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+
+	for (started = 0; started < nthreads; started++)
+	{
+		if (pthread_create(&threads[started], NULL, pkgconf_scan_worker, &pool) != 0)
+			break;
+	}
+
+	if (started == 0)
+	{
+		pthread_cond_destroy(&pool.cond);
+		pthread_mutex_destroy(&pool.mutex);
+		free(pool.jobs);
+		free(threads);
+		return false;
+	}
+
+	PKGCONF_TRACE(client, "loading " SIZE_FMT_SPECIFIER " packages with " SIZE_FMT_SPECIFIER " workers", count, started);
+
+	for (i = 0; i < count && !stop; i++)
+	{
+		pkgconf_scan_job_t *job = &pool.jobs[i];
+
+		pthread_mutex_lock(&pool.mutex);
+		while (!job->done)
+			pthread_cond_wait(&pool.cond, &pool.mutex);
+		pthread_mutex_unlock(&pool.mutex);
+
+		pkgconf_scan_job_finish(client, job, true);
+		stop = consume(client, job->pkg, data);
+		job->pkg = NULL;
+	}
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.cancel = true;
+	pthread_mutex_unlock(&pool.mutex);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	pkgconf_scan_merge_stats(&client->stats, &pool.stats);
+
+	/* release whatever the workers loaded past the point where iteration stopped */
+	for (i = 0; i < count; i++)
+	{
+		pkgconf_scan_job_finish(client, &pool.jobs[i], false);
+		if (pool.jobs[i].pkg != NULL)
+			pkgconf_pkg_unref(client, pool.jobs[i].pkg);
+	}
+
+	pthread_cond_destroy(&pool.cond);
+	pthread_mutex_destroy(&pool.mutex);
+	free(pool.jobs);
+	free(threads);
+
+	return true;
+}
+
+typedef struct {
+	void *data;
+	pkgconf_pkg_iteration_func_t func;
+	pkgconf_pkg_t *outpkg;
+} pkgconf_scan_iteration_t;
+
+static bool
+pkgconf_scan_iterate(pkgconf_client_t *client, pkgconf_pkg_t *pkg, void *data)
+{
+	pkgconf_scan_iteration_t *it = data;
+
+	return pkgconf_pkg_scan_consume(client, pkg, it->data, it->func, &it->outpkg);
+}
+#endif
+
+/*
+ * pkgconf_pkg_scan_files(client, pnode, filenames, count, data, func)
+ *
+ * run `func` on the packages in `filenames`, in order, on a worker pool if the client
+ * has one configured.
+ */
+static pkgconf_pkg_t *
+pkgconf_pkg_scan_files(pkgconf_client_t *client, pkgconf_path_t *pnode, const char **filenames, size_t count, void *data, pkgconf_pkg_iteration_func_t func)
+{
+	pkgconf_pkg_t *outpkg = NULL;
+	size_t i;
+
+#ifdef PKGCONF_PARALLEL_SCAN
+	pkgconf_scan_iteration_t it = {
+		.data = data,
+		.func = func,
+	};
+
+	/* the directory snapshot and descriptor must exist before workers consult them */
+	(void) pkgconf_path_dirfd(pnode);
+
+	if (client->scan_workers > 1 && count > 1 && pnode->index != NULL &&
+	    pkgconf_pkg_scan_parallel(client, pnode, pkgconf_pkg_scan_load, filenames, count, pkgconf_scan_iterate, &it))
+		return it.outpkg;
+#endif
+
+	for (i = 0; i < count; i++)
+	{
+		if (pkgconf_pkg_scan_consume(client, pkgconf_pkg_scan_load(client, pnode, filenames[i]), data, func, &outpkg))
+			break;
+	}
+
+	return outpkg;
+}
+
+/*
+ * pkgconf_pkg_opendir(pnode)
+ *
+ * open a search directory for listing, through its directory descriptor if it has one.
+ */
+static DIR *
+pkgconf_pkg_opendir(pkgconf_path_t *pnode)
+{
+#ifdef PKGCONF_OPENAT
+	int dirfd = pkgconf_path_dirfd(pnode);
+
+	if (dirfd >= 0)
+	{
+		DIR *dir;
+		int fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+		if (fd < 0)
+			return NULL;
+
+		if ((dir = fdopendir(fd)) == NULL)
+			close(fd);
+
+		return dir;
+	}
+#endif
+
+	return opendir(pnode->path);
+}
+
+/*
+ * pkgconf_pkg_scan_dir(client, pnode, data, func, provider)
+ *
+ * run `func` on every package in a search directory, using its persistent index instead of
+ * listing it if possible.  if `provider` is set, packages which are known not to have a
+ * Provides rule for it are skipped.
+ */
+static pkgconf_pkg_t *
+pkgconf_pkg_scan_dir(pkgconf_client_t *client, pkgconf_path_t *pnode, void *data, pkgconf_pkg_iteration_func_t func, const char *provider)
+{
+	const pkgconf_dirindex_record_t *records;
+	const char **filenames = NULL;
+	char **names = NULL;
+	size_t count, nfiles = 0, size = 0, i;
+	DIR *dir;
+	struct dirent *dirent;
+	pkgconf_pkg_t *outpkg = NULL;
+
+	records = pkgconf_dirindex_records(client, pnode, &count);
+	if (records != NULL)
+	{
+		PKGCONF_TRACE(client, "scanning index of dir [%s]", pnode->path);
+
+		filenames = calloc(count ? count : 1, sizeof(char *));
+		if (filenames == NULL)
+			return NULL;
+
+		for (i = 0; i < count; i++)
+		{
+			if (provider != NULL && !pkgconf_dirindex_record_provides(client, &records[i], provider))
+				continue;
+
+			filenames[nfiles++] = records[i].filename;
+		}
+
+		outpkg = pkgconf_pkg_scan_files(client, pnode, filenames, nfiles, data, func);
+		free(filenames);
+
+		return outpkg;
+	}
+
+	dir = pkgconf_pkg_opendir(pnode);
+	if (dir == NULL)
+		return NULL;
+
+	PKGCONF_TRACE(client, "scanning dir [%s]", pnode->path);
+
+	for (dirent = readdir(dir); dirent != NULL; dirent = readdir(dir))
+	{
+		if (!str_has_suffix(dirent->d_name, PKG_CONFIG_EXT))
+			continue;
+
+		if (nfiles == size)
+		{
+			char **newnames = realloc(names, (size ? size * 2 : 64) * sizeof(char *));
+
+			if (newnames == NULL)
+				break;
+
+			names = newnames;
+			size = size ? size * 2 : 64;
+		}
+
+		if ((names[nfiles] = strdup(dirent->d_name)) != NULL)
+			nfiles++;
+	}
+
+	closedir(dir);
+
+	outpkg = pkgconf_pkg_scan_files(client, pnode, (const char **) names, nfiles, data, func);
+
+	for (i = 0; i < nfiles; i++)
+		free(names[i]);
+	free(names);
+
+	return outpkg;
+}
+
+static pkgconf_pkg_t *
+pkgconf_pkg_scan_dir_list(pkgconf_client_t *client, void *data, pkgconf_pkg_iteration_func_t func, const char *provider)
+{
+	pkgconf_node_t *n;
+	pkgconf_pkg_t *pkg;
+
+	PKGCONF_FOREACH_LIST_ENTRY(client->dir_list.head, n)
+	{
+		pkgconf_path_t *pnode = n->data;
+
+		PKGCONF_TRACE(client, "scanning directory: %s", pnode->path);
+
+		if ((pkg = pkgconf_pkg_scan_dir(client, pnode, data, func, provider)) != NULL)
+			return pkg;
+	}
+
+	return NULL;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkgconf_pkg_t *pkgconf_scan_all(pkgconf_client_t *client, void *data, pkgconf_pkg_iteration_func_t func)
+ *
+ *    Iterates over all packages found in the `package directory list`, running ``func`` on them.  If ``func`` returns true,
+ *    then stop iteration and return the last iterated package.
+ *
+ *    :param pkgconf_client_t* client: The pkgconf client object to use for dependency resolution.
+ *    :param void* data: An opaque pointer to data to provide the iteration function with.
+ *    :param pkgconf_pkg_iteration_func_t func: A function which is called for each package to determine if the package matches,
+ *        always return ``false`` to iterate over all packages.
+ *    :return: A package object reference if one is found by the scan function, else ``NULL``.
+ *    :rtype: pkgconf_pkg_t *
+ */
+pkgconf_pkg_t *
+pkgconf_scan_all(pkgconf_client_t *client, void *data, pkgconf_pkg_iteration_func_t func)
+{
+	return pkgconf_pkg_scan_dir_list(client, data, func, NULL);
+}
+
+#ifdef _WIN32
+static pkgconf_pkg_t *
+pkgconf_pkg_find_in_registry_key(pkgconf_client_t *client, HKEY hkey, const char *name)
+{
+	pkgconf_pkg_t *pkg = NULL;
+
+	HKEY key;
+	int i = 0;
+
+	char buf[16384]; /* per registry limits */
+	DWORD bufsize = sizeof buf;
+	if (RegOpenKeyEx(hkey, PKG_CONFIG_REG_KEY,
+				0, KEY_READ, &key) != ERROR_SUCCESS)
+		return NULL;
+
+	while (RegEnumValue(key, i++, buf, &bufsize, NULL, NULL, NULL, NULL)
+			== ERROR_SUCCESS)
+	{
+		char pathbuf[PKGCONF_ITEM_SIZE];
+		DWORD type;
+		DWORD pathbuflen = sizeof pathbuf;
+
+		if (RegQueryValueEx(key, buf, NULL, &type, (LPBYTE) pathbuf, &pathbuflen)
+				== ERROR_SUCCESS && type == REG_SZ)
+		{
+			pkg = pkgconf_pkg_try_specific_path(client, NULL, pathbuf, name);
+			if (pkg != NULL)
+				break;
+		}
+
+		bufsize = sizeof buf;
+	}
+
+	RegCloseKey(key);
+	return pkg;
+}
+#endif
+
+/*
+ * !doc
+ *
+ * .. c:function:: pkgconf_pkg_t *pkgconf_pkg_find(pkgconf_client_t *client, const char *name)
+ *
+ *    Search for a package.
+ *
+ *    :param pkgconf_client_t* client: The pkgconf client object to use for dependency resolution.
+ *    :param char* name: The name of the package `atom` to use for searching.
+ *    :return: A package object reference if the package was found, else ``NULL``.
+ *    :rtype: pkgconf_pkg_t *
+ */
+pkgconf_pkg_t *
+pkgconf_pkg_find(pkgconf_client_t *client, const char *name)
+{
+	pkgconf_pkg_t *pkg = NULL;
+	pkgconf_node_t *n;
+	FILE *f;
+
+	PKGCONF_TRACE(client, "looking for: %s", name);
+
+	/* name might actually be a filename. */
+	if (str_has_suffix(name, PKG_CONFIG_EXT))
+	{
+		if ((f = fopen(name, "r")) != NULL)
+		{
+			PKGCONF_TRACE(client, "%s is a file", name);
+
+			pkg = pkgconf_pkg_load_file(client, name, f, 0, true);
+			if (pkg != NULL)
+			{
+				pkgconf_path_add(pkg->pc_filedir, &client->dir_list, true);
+				goto out;
+			}
+		}
+	}
+
+	/* check builtins */
+	if ((pkg = pkgconf_builtin_pkg_get(name)) != NULL)
+	{
+		PKGCONF_TRACE(client, "%s is a builtin", name);
+		return pkg;
+	}
+
+	/* check cache */
+	if (!(client->flags & PKGCONF_PKG_PKGF_NO_CACHE) && (pkg = pkgconf_cache_lookup(client, name)) != NULL)
+	{
+		PKGCONF_TRACE(client, "%s is cached", name);
+		return pkg;
+	}
+
+	if (!(client->flags & PKGCONF_PKG_PKGF_NO_CACHE) && pkgconf_cache_lookup_miss(client, name))
+		goto registry;
+
+	PKGCONF_FOREACH_LIST_ENTRY(client->dir_list.head, n)
+	{
+		pkgconf_path_t *pnode = n->data;
+
+		pkg = pkgconf_pkg_try_specific_path(client, pnode, pnode->path, name);
+		if (pkg != NULL)
+			goto out;
+	}
+
+	/* the registry is not covered by the generation of the search path, so it is asked even
+	 * for modules which are known to be missing from the search path.
+	 */
+registry:
+#ifdef _WIN32
+	/* support getting PKG_CONFIG_PATH from registry */
+	pkg = pkgconf_pkg_find_in_registry_key(client, HKEY_CURRENT_USER, name);
+	if (!pkg)
+		pkg = pkgconf_pkg_find_in_registry_key(client, HKEY_LOCAL_MACHINE, name);
+#endif
+
+out:
+	if (pkg == NULL && !(client->flags & PKGCONF_PKG_PKGF_NO_CACHE))
+		pkgconf_cache_add_miss(client, name);
+
+	pkgconf_cache_add(client, pkg);
+
+	return pkg;
+}
+
+/*
+ * Preloading walks the requested modules and their dependencies breadth first.  Every module
+ * name that was asked for so far is kept once in `names`, and each round loads the names
+ * the previous round appended, on the scan worker pool if the client has one.
+ */
+typedef struct {
+	char **names;
+	size_t count;
+	size_t capacity;
+} pkgconf_preload_t;
+
+static void
+pkgconf_preload_want(pkgconf_client_t *client, pkgconf_preload_t *state, const char *name)
+{
+	pkgconf_pkg_t *pkg;
+	size_t i;
+
+	/* builtins need no loading, and files named directly are left to pkgconf_pkg_find() */
+	if (pkgconf_builtin_pkg_get(name) != NULL || str_has_suffix(name, PKG_CONFIG_EXT))
+		return;
+
+	for (i = 0; i < state->count; i++)
+	{
+		if (!strcmp(state->names[i], name))
+			return;
+	}
+
+	if ((pkg = pkgconf_cache_lookup(client, name)) != NULL)
+	{
+		pkgconf_pkg_unref(client, pkg);
+		return;
+	}
+
+	if (pkgconf_cache_lookup_miss(client, name))
+		return;
+
+	if (state->count == state->capacity)
+	{
+		size_t capacity = state->capacity ? state->capacity * 2 : 16;
+		char **names = realloc(state->names, capacity * sizeof(char *));
+
+		if (names == NULL)
+			return;
+
+		state->names = names;
+		state->capacity = capacity;
+	}
+
+	if ((state->names[state->count] = strdup(name)) != NULL)
+		state->count++;
+}
+
+static bool
+pkgconf_preload_consume(pkgconf_client_t *client, pkgconf_pkg_t *pkg, void *data)
+{
+	pkgconf_preload_t *state = data;
+	pkgconf_node_t *n;
+
+	if (pkg == NULL)
+		return false;
+
+	pkgconf_cache_add(client, pkg);
+
+	PKGCONF_FOREACH_LIST_ENTRY(pkg->required.head, n)
+	{
+		pkgconf_dependency_t *dep = n->data;
+
+		pkgconf_preload_want(client, state, dep->package);
+	}
+
+	if (client->flags & PKGCONF_PKG_PKGF_SEARCH_PRIVATE)
+	{
+		PKGCONF_FOREACH_LIST_ENTRY(pkg->requires_private.head, n)
+		{
+			pkgconf_dependency_t *dep = n->data;
+
+			pkgconf_preload_want(client, state, dep->package);
+		}
+	}
+
+	pkgconf_pkg_unref(client, pkg);
+
+	return false;
+}
+
+#ifdef PKGCONF_PARALLEL_SCAN
+/*
+ * pkgconf_preload_load(client, pnode, name)
+ *
+ * look a module up in the search path, bypassing the cache, which workers must not touch.
+ * `pnode` is unused, the whole search path is consulted.
+ */
+static pkgconf_pkg_t *
+pkgconf_preload_load(pkgconf_client_t *client, pkgconf_path_t *pnode, const char *name)
+{
+	pkgconf_node_t *n;
+	pkgconf_pkg_t *pkg;
+	(void) pnode;
+
+	PKGCONF_FOREACH_LIST_ENTRY(client->dir_list.head, n)
+	{
+		pkgconf_path_t *dir = n->data;
+
+		if ((pkg = pkgconf_pkg_try_specific_path(client, dir, dir->path, name)) != NULL)
+			return pkg;
+	}
 
-	HKEY key;
-	int i = 0;
+	return NULL;
+}
 
-	char buf[16384]; /* per registry limits */
-	DWORD bufsize = sizeof buf;
-	if (RegOpenKeyEx(hkey, PKG_CONFIG_REG_KEY,
-				0, KEY_READ, &key) != ERROR_SUCCESS)
-		return NULL;
+/*
+ * pkgconf_preload_parallel(client)
+ *
+ * check whether modules can be loaded on worker threads: this needs a snapshot and a
+ * descriptor for every search directory, as workers may not create them.
+ */
+static bool
+pkgconf_preload_parallel(pkgconf_client_t *client)
+{
+	pkgconf_node_t *n;
 
-	while (RegEnumValue(key, i++, buf, &bufsize, NULL, NULL, NULL, NULL)
-			== ERROR_SUCCESS)
+	if (client->scan_workers <= 1 || pkgconf_dirindex_search_generation(client) == 0)
+		return false;
+
+	PKGCONF_FOREACH_LIST_ENTRY(client->dir_list.head, n)
 	{
-		char pathbuf[PKGCONF_ITEM_SIZE];
-		DWORD type;
-		DWORD pathbuflen = sizeof pathbuf;
+		pkgconf_path_t *dir = n->data;
 
-		if (RegQueryValueEx(key, buf, NULL, &type, (LPBYTE) pathbuf, &pathbuflen)
-				== ERROR_SUCCESS && type == REG_SZ)
-		{
-			pkg = pkgconf_pkg_try_specific_path(client, pathbuf, name);
-			if (pkg != NULL)
-				break;
-		}
+		if (dir->index == NULL)
+			return false;
 
-		bufsize = sizeof buf;
+		(void) pkgconf_path_dirfd(dir);
 	}
 
-	RegCloseKey(key);
-	return pkg;
+	return true;
 }
 #endif
 
 /*
  * !doc
  *
- * .. c:function:: pkgconf_pkg_t *pkgconf_pkg_find(pkgconf_client_t *client, const char *name)
+ * .. c:function:: void pkgconf_cache_preload(pkgconf_client_t *client, const char **names, size_t count)
  *
- *    Search for a package.
+ *    Loads a batch of modules into the package cache, along with the modules they require,
+ *    so that resolving them later is answered from the cache.  ``Requires.private`` is
+ *    followed as well if the client searches private dependencies.  If the client has scan
+ *    workers configured, each round of modules is located and parsed on the worker pool.
+ *    Modules which cannot be found are skipped, they are reported when they are resolved.
  *
- *    :param pkgconf_client_t* client: The pkgconf client object to use for dependency resolution.
- *    :param char* name: The name of the package `atom` to use for searching.
- *    :return: A package object reference if the package was found, else ``NULL``.
- *    :rtype: pkgconf_pkg_t *
+ *    :param pkgconf_client_t* client: The client object to preload modules for.
+ *    :param char** names: The names of the modules to load.
+ *    :param size_t count: The number of names in `names`.
+ *    :return: nothing
  */
-pkgconf_pkg_t *
-pkgconf_pkg_find(pkgconf_client_t *client, const char *name)
+void
+pkgconf_cache_preload(pkgconf_client_t *client, const char **names, size_t count)
 {
-	pkgconf_pkg_t *pkg = NULL;
-	pkgconf_node_t *n;
-	FILE *f;
-
-	PKGCONF_TRACE(client, "looking for: %s", name);
+	pkgconf_preload_t state = { 0 };
+	size_t start = 0, i;
 
-	/* name might actually be a filename. */
-	if (str_has_suffix(name, PKG_CONFIG_EXT))
-	{
-		if ((f = fopen(name, "r")) != NULL)
-		{
-			PKGCONF_TRACE(client, "%s is a file", name);
+	if (client->flags & PKGCONF_PKG_PKGF_NO_CACHE)
+		return;
 
-			pkg = pkgconf_pkg_new_from_file(client, name, f, 0);
-			if (pkg != NULL)
-			{
-				pkgconf_path_add(pkg->pc_filedir, &client->dir_list, true);
-				goto out;
-			}
-		}
-	}
+	for (i = 0; i < count; i++)
+		pkgconf_preload_want(client, &state, names[i]);
 
-	/* check builtins */
-	if ((pkg = pkgconf_builtin_pkg_get(name)) != NULL)
+	while (start < state.count)
 	{
-		PKGCONF_TRACE(client, "%s is a builtin", name);
-		return pkg;
-	}
+		size_t end = state.count;
 
-	/* check cache */
-	if (!(client->flags & PKGCONF_PKG_PKGF_NO_CACHE))
-	{
-		if ((pkg = pkgconf_cache_lookup(client, name)) != NULL)
+		PKGCONF_TRACE(client, "preloading " SIZE_FMT_SPECIFIER " modules", end - start);
+
+#ifdef PKGCONF_PARALLEL_SCAN
+		if (end - start > 1 && pkgconf_preload_parallel(client) &&
+		    pkgconf_pkg_scan_parallel(client, NULL, pkgconf_preload_load, (const char **) state.names + start, end - start, pkgconf_preload_consume, &state))
 		{
-			PKGCONF_TRACE(client, "%s is cached", name);
-			return pkg;
+			start = end;
+			continue;
 		}
-	}
+#endif
 
-	PKGCONF_FOREACH_LIST_ENTRY(client->dir_list.head, n)
-	{
-		pkgconf_path_t *pnode = n->data;
+		for (i = start; i < end; i++)
+			pkgconf_preload_consume(client, pkgconf_pkg_find(client, state.names[i]), &state);
 
-		pkg = pkgconf_pkg_try_specific_path(client, pnode->path, name);
-		if (pkg != NULL)
-			goto out;
+		start = end;
 	}
 
-#ifdef _WIN32
-	/* support getting PKG_CONFIG_PATH from registry */
-	pkg = pkgconf_pkg_find_in_registry_key(client, HKEY_CURRENT_USER, name);
-	if (!pkg)
-		pkg = pkgconf_pkg_find_in_registry_key(client, HKEY_LOCAL_MACHINE, name);
-#endif
-
-out:
-	pkgconf_cache_add(client, pkg);
+	for (i = 0; i < state.count; i++)
+		free(state.names[i]);
 
-	return pkg;
+	free(state.names);
 }
 
 /*
@@ -1289,23 +2140,23 @@ static const pkgconf_pkg_provides_vermatch_rule_t pkgconf_pkg_provides_vermatch_
 };
 
 /*
- * pkgconf_pkg_scan_provides_vercmp(pkgdep, provider)
+ * pkgconf_pkg_scan_provides_vercmp(pkgdep, compare, version)
  *
  * compare a provides node against the requested dependency node.
  *
  * XXX: maybe handle PKGCONF_CMP_ANY in a versioned comparison
  */
 static bool
-pkgconf_pkg_scan_provides_vercmp(const pkgconf_dependency_t *pkgdep, const pkgconf_dependency_t *provider)
+pkgconf_pkg_scan_provides_vercmp(const pkgconf_dependency_t *pkgdep, pkgconf_pkg_comparator_t compare, const char *version)
 {
 	const pkgconf_pkg_provides_vermatch_rule_t *rule = &pkgconf_pkg_provides_vermatch_rules[pkgdep->compare];
 
-	if (rule->depcmp[provider->compare] != NULL &&
-	    !rule->depcmp[provider->compare](provider->version, pkgdep->version))
+	if (rule->depcmp[compare] != NULL &&
+	    !rule->depcmp[compare](version, pkgdep->version))
 		return false;
 
-	if (rule->rulecmp[provider->compare] != NULL &&
-	    !rule->rulecmp[provider->compare](pkgdep->version, provider->version))
+	if (rule->rulecmp[compare] != NULL &&
+	    !rule->rulecmp[compare](pkgdep->version, version))
 		return false;
 
 	return true;
@@ -1326,26 +2177,365 @@ pkgconf_pkg_scan_provides_entry(const pkgconf_pkg_t *pkg, const pkgconf_pkg_scan
 	{
 		const pkgconf_dependency_t *provider = node->data;
 		if (!strcmp(provider->package, pkgdep->package))
-			return pkgconf_pkg_scan_provides_vercmp(pkgdep, provider);
+			return pkgconf_pkg_scan_provides_vercmp(pkgdep, provider->compare, provider->version);
+	}
+
+	return false;
+}
+
+/*
+ * The reverse Provides index maps each name which appears in a Provides rule to the modules
+ * providing it, in search order.  It is built the first time a dependency falls through to
+ * the provider scan, from the persistent module index of a search directory where there is
+ * one (so nothing has to be parsed) and by loading the directory's modules otherwise, and
+ * then kept for as long as the generation of the search path does not change.  Entries refer
+ * to their directory by its position in the search path rather than by its path node, as the
+ * search path may be rebuilt with new nodes for the same directories, which keeps the
+ * generation.
+ */
+typedef struct {
+	char *provider;
+	char *version;
+	pkgconf_pkg_comparator_t compare;
+	size_t dir;
+	char *filename;
+	size_t next;
+} pkgconf_provides_entry_t;
+
+typedef struct {
+	size_t head;
+	size_t tail;
+} pkgconf_provides_slot_t;
+
+struct pkgconf_provides_index_ {
+	pkgconf_provides_entry_t *entries;
+	size_t count;
+	size_t size;
+
+	/* slots hold 1-based entry indices, so that 0 marks an empty slot */
+	pkgconf_provides_slot_t *slots;
+	size_t capacity;
+
+	uint64_t generation;
+};
+
+typedef struct {
+	pkgconf_provides_index_t *index;
+	size_t dir;
+} pkgconf_provides_build_ctx_t;
+
+static uint32_t
+pkgconf_provides_hash(const char *str)
+{
+	uint32_t hash = 2166136261U;
+
+	for (; *str; str++)
+	{
+		hash ^= (unsigned char) *str;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static pkgconf_provides_slot_t *
+pkgconf_provides_slot(const pkgconf_provides_index_t *index, const char *provider)
+{
+	size_t mask = index->capacity - 1;
+	size_t i = pkgconf_provides_hash(provider) & mask;
+
+	while (index->slots[i].head != 0 && strcmp(index->entries[index->slots[i].head - 1].provider, provider))
+		i = (i + 1) & mask;
+
+	return &index->slots[i];
+}
+
+static bool
+pkgconf_provides_grow(pkgconf_provides_index_t *index)
+{
+	pkgconf_provides_slot_t *oldslots = index->slots;
+	size_t oldcapacity = index->capacity, i;
+
+	index->capacity = oldcapacity ? oldcapacity * 2 : 64;
+	index->slots = calloc(index->capacity, sizeof(pkgconf_provides_slot_t));
+	if (index->slots == NULL)
+	{
+		index->slots = oldslots;
+		index->capacity = oldcapacity;
+		return false;
+	}
+
+	for (i = 0; i < oldcapacity; i++)
+	{
+		if (oldslots[i].head != 0)
+			*pkgconf_provides_slot(index, index->entries[oldslots[i].head - 1].provider) = oldslots[i];
+	}
+
+	free(oldslots);
+	return true;
+}
+
+/*
+ * pkgconf_provides_index_add(index, dir, filename, provides)
+ *
+ * add the Provides rules of one module to the index.  only the first rule for each name counts,
+ * as that is the one the provider scan would have compared against.
+ */
+static void
+pkgconf_provides_index_add(pkgconf_provides_index_t *index, size_t dir, const char *filename, const pkgconf_list_t *provides)
+{
+	pkgconf_node_t *node, *prev;
+
+	PKGCONF_FOREACH_LIST_ENTRY(provides->head, node)
+	{
+		const pkgconf_dependency_t *dep = node->data;
+		pkgconf_provides_entry_t *entry;
+		pkgconf_provides_slot_t *slot;
+		bool seen = false;
+
+		PKGCONF_FOREACH_LIST_ENTRY(provides->head, prev)
+		{
+			if (prev == node)
+				break;
+
+			if (!strcmp(((const pkgconf_dependency_t *) prev->data)->package, dep->package))
+			{
+				seen = true;
+				break;
+			}
+		}
+
+		if (seen)
+			continue;
+
+		if (index->count == index->size)
+		{
+			size_t newsize = index->size ? index->size * 2 : 64;
+			pkgconf_provides_entry_t *newentries = realloc(index->entries, newsize * sizeof(pkgconf_provides_entry_t));
+
+			if (newentries == NULL)
+				return;
+
+			index->entries = newentries;
+			index->size = newsize;
+		}
+
+		if ((index->count + 1) * 2 > index->capacity && !pkgconf_provides_grow(index))
+			return;
+
+		entry = &index->entries[index->count];
+		entry->provider = strdup(dep->package);
+		entry->version = dep->version != NULL ? strdup(dep->version) : NULL;
+		entry->compare = dep->compare;
+		entry->dir = dir;
+		entry->filename = strdup(filename);
+		entry->next = 0;
+
+		if (entry->provider == NULL || entry->filename == NULL)
+		{
+			free(entry->provider);
+			free(entry->version);
+			free(entry->filename);
+			return;
+		}
+
+		index->count++;
+
+		slot = pkgconf_provides_slot(index, entry->provider);
+		if (slot->head == 0)
+			slot->head = index->count;
+		else
+			index->entries[slot->tail - 1].next = index->count;
+		slot->tail = index->count;
 	}
+}
+
+static bool
+pkgconf_provides_index_collect(const pkgconf_pkg_t *pkg, void *data)
+{
+	pkgconf_provides_build_ctx_t *ctx = data;
+	const char *filename = strrchr(pkg->filename, '/');
+
+	pkgconf_provides_index_add(ctx->index, ctx->dir, filename != NULL ? filename + 1 : pkg->filename, &pkg->provides);
 
 	return false;
 }
 
+/*
+ * pkgconf_provides_index_get(client)
+ *
+ * return the client's reverse Provides index, building it if needed.
+ */
+static pkgconf_provides_index_t *
+pkgconf_provides_index_get(pkgconf_client_t *client)
+{
+	pkgconf_provides_index_t *index = client->provides_index;
+	uint64_t generation = pkgconf_dirindex_search_generation(client);
+	pkgconf_node_t *n;
+	size_t dir = 0;
+
+	/* the index describes a particular state of the search path */
+	if (index != NULL && generation != 0 && index->generation == generation)
+		return index;
+
+	pkgconf_pkg_provides_index_free(client);
+
+	index = calloc(1, sizeof(pkgconf_provides_index_t));
+	if (index == NULL || !pkgconf_provides_grow(index))
+	{
+		free(index);
+		return NULL;
+	}
+
+	for (n = client->dir_list.head; n != NULL; n = n->next, dir++)
+	{
+		pkgconf_path_t *pnode = n->data;
+		const pkgconf_dirindex_record_t *records;
+		size_t count, i;
+
+		records = pkgconf_dirindex_records(client, pnode, &count);
+		if (records == NULL)
+		{
+			pkgconf_provides_build_ctx_t ctx = {
+				.index = index,
+				.dir = dir,
+			};
+
+			PKGCONF_TRACE(client, "indexing provides of dir [%s]", pnode->path);
+			pkgconf_pkg_scan_dir(client, pnode, &ctx, pkgconf_provides_index_collect, NULL);
+			continue;
+		}
+
+		PKGCONF_TRACE(client, "indexing provides from index of dir [%s]", pnode->path);
+
+		for (i = 0; i < count; i++)
+		{
+			pkgconf_list_t provides = PKGCONF_LIST_INITIALIZER;
+
+			if (*records[i].provides == '\0')
+				continue;
+
+			pkgconf_dependency_parse_str(client, &provides, records[i].provides, 0);
+			pkgconf_provides_index_add(index, dir, records[i].filename, &provides);
+			pkgconf_dependency_free(&provides);
+		}
+	}
+
+	index->generation = generation;
+	client->provides_index = index;
+
+	PKGCONF_TRACE(client, "indexed " SIZE_FMT_SPECIFIER " provides", index->count);
+
+	return index;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_pkg_provides_index_free(pkgconf_client_t *client)
+ *
+ *    Releases the reverse ``Provides`` index of a client, which is built the first time a
+ *    dependency has to be resolved through ``Provides`` rules.  The index is rebuilt when it is
+ *    next needed, which also happens on its own when the generation of the search path changes.
+ *
+ *    :param pkgconf_client_t* client: The client object whose index is released.
+ *    :return: nothing
+ */
+void
+pkgconf_pkg_provides_index_free(pkgconf_client_t *client)
+{
+	pkgconf_provides_index_t *index = client->provides_index;
+	size_t i;
+
+	if (index == NULL)
+		return;
+
+	for (i = 0; i < index->count; i++)
+	{
+		free(index->entries[i].provider);
+		free(index->entries[i].version);
+		free(index->entries[i].filename);
+	}
+
+	free(index->entries);
+	free(index->slots);
+	free(index);
+
+	client->provides_index = NULL;
+}
+
+/* the search directory at position `dir` of the search path */
+static pkgconf_path_t *
+pkgconf_provides_dir(const pkgconf_client_t *client, size_t dir)
+{
+	pkgconf_node_t *n;
+
+	for (n = client->dir_list.head; n != NULL && dir > 0; n = n->next)
+		dir--;
+
+	return n != NULL ? n->data : NULL;
+}
+
+/*
+ * pkgconf_pkg_scan_providers_indexed(client, index, ctx)
+ *
+ * find the first package whose Provides rule matches the pkgdep using the reverse Provides index.
+ * candidates are loaded and checked again, in case they changed after the index was built.
+ */
+static pkgconf_pkg_t *
+pkgconf_pkg_scan_providers_indexed(pkgconf_client_t *client, const pkgconf_provides_index_t *index, const pkgconf_pkg_scan_providers_ctx_t *ctx)
+{
+	const pkgconf_dependency_t *pkgdep = ctx->pkgdep;
+	size_t i;
+
+	for (i = pkgconf_provides_slot(index, pkgdep->package)->head; i != 0; i = index->entries[i - 1].next)
+	{
+		const pkgconf_provides_entry_t *entry = &index->entries[i - 1];
+		pkgconf_path_t *pnode;
+		pkgconf_pkg_t *pkg;
+
+		if (!pkgconf_pkg_scan_provides_vercmp(pkgdep, entry->compare, entry->version))
+			continue;
+
+		if ((pnode = pkgconf_provides_dir(client, entry->dir)) == NULL)
+			continue;
+
+		PKGCONF_TRACE(client, "%s may be provided by %s/%s", pkgdep->package, pnode->path, entry->filename);
+
+		pkg = pkgconf_pkg_scan_load(client, pnode, entry->filename);
+		if (pkg == NULL)
+			continue;
+
+		if (pkgconf_pkg_scan_provides_entry(pkg, ctx))
+			return pkg;
+
+		pkgconf_pkg_unref(client, pkg);
+	}
+
+	return NULL;
+}
+
 /*
  * pkgconf_pkg_scan_providers(client, pkgdep, eflags)
  *
- * scan all available packages to see if a Provides rule matches the pkgdep.
+ * find the first available package with a Provides rule that matches the pkgdep.
  */
 static pkgconf_pkg_t *
 pkgconf_pkg_scan_providers(pkgconf_client_t *client, pkgconf_dependency_t *pkgdep, unsigned int *eflags)
 {
 	pkgconf_pkg_t *pkg;
+	pkgconf_provides_index_t *index;
 	pkgconf_pkg_scan_providers_ctx_t ctx = {
 		.pkgdep = pkgdep,
 	};
 
-	pkg = pkgconf_scan_all(client, &ctx, (pkgconf_pkg_iteration_func_t) pkgconf_pkg_scan_provides_entry);
+	client->stats.provider_scans++;
+
+	if ((index = pkgconf_provides_index_get(client)) != NULL)
+		pkg = pkgconf_pkg_scan_providers_indexed(client, index, &ctx);
+	else
+		pkg = pkgconf_pkg_scan_dir_list(client, &ctx, (pkgconf_pkg_iteration_func_t) pkgconf_pkg_scan_provides_entry, pkgdep->package);
+
 	if (pkg != NULL)
 	{
 		pkgdep->match = pkgconf_pkg_ref(client, pkg);
@@ -1632,6 +2822,7 @@ pkgconf_pkg_traverse_main(pkgconf_client_t *client,
 		return eflags;
 
 	root->serial = client->serial;
+	client->stats.traversal_visits++;
 
 	if (root->identifier == 0)
 		root->identifier = ++client->identifier;
@@ -1697,6 +2888,8 @@ pkgconf_pkg_cflags_collect(pkgconf_client_t *client, pkgconf_pkg_t *pkg, void *d
 	pkgconf_list_t *list = data;
 	pkgconf_node_t *node;
 
+	pkgconf_pkg_load_fragments(client, pkg);
+
 	PKGCONF_FOREACH_LIST_ENTRY(pkg->cflags.head, node)
 	{
 		pkgconf_fragment_t *frag = node->data;
@@ -1710,6 +2903,8 @@ pkgconf_pkg_cflags_private_collect(pkgconf_client_t *client, pkgconf_pkg_t *pkg,
 	pkgconf_list_t *list = data;
 	pkgconf_node_t *node;
 
+	pkgconf_pkg_load_fragments(client, pkg);
+
 	PKGCONF_FOREACH_LIST_ENTRY(pkg->cflags_private.head, node)
 	{
 		pkgconf_fragment_t *frag = node->data;
@@ -1761,6 +2956,8 @@ pkgconf_pkg_libs_collect(pkgconf_client_t *client, pkgconf_pkg_t *pkg, void *dat
 	pkgconf_list_t *list = data;
 	pkgconf_node_t *node;
 
+	pkgconf_pkg_load_fragments(client, pkg);
+
 	PKGCONF_FOREACH_LIST_ENTRY(pkg->libs.head, node)
 	{
 		pkgconf_fragment_t *frag = node->data;
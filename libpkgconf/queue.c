@@ -223,6 +223,33 @@ pkgconf_queue_collect_dependencies(pkgconf_client_t *client,
 	return pkgconf_queue_collect_dependencies_main(client, root, data, maxdepth);
 }
 
+/*
+ * pkgconf_queue_preload(client, world)
+ *
+ * load the requested modules and their dependencies on the scan worker pool ahead of the
+ * traversal, which would otherwise find them one by one.
+ */
+static void
+pkgconf_queue_preload(pkgconf_client_t *client, pkgconf_pkg_t *world)
+{
+	const char **names = calloc(world->required.length, sizeof(char *));
+	pkgconf_node_t *iter;
+	size_t count = 0;
+
+	if (names == NULL)
+		return;
+
+	PKGCONF_FOREACH_LIST_ENTRY(world->required.head, iter)
+	{
+		pkgconf_dependency_t *dep = iter->data;
+
+		names[count++] = dep->package;
+	}
+
+	pkgconf_cache_preload(client, names, count);
+	free(names);
+}
+
 static inline unsigned int
 pkgconf_queue_verify(pkgconf_client_t *client, pkgconf_pkg_t *world, pkgconf_list_t *list, int maxdepth)
 {
@@ -234,12 +261,20 @@ pkgconf_queue_verify(pkgconf_client_t *client, pkgconf_pkg_t *world, pkgconf_lis
 		.flags = PKGCONF_PKG_PROPF_STATIC | PKGCONF_PKG_PROPF_VIRTUAL,
 	};
 
+	/* the snapshots of the search path, and the misses recorded against them, are checked
+	 * once per solve rather than on every lookup.
+	 */
+	pkgconf_dirindex_refresh_search(client);
+
 	if (!pkgconf_queue_compile(client, &initial_world, list))
 	{
 		pkgconf_solution_free(client, &initial_world);
 		return PKGCONF_PKG_ERRF_DEPGRAPH_BREAK;
 	}
 
+	if (client->scan_workers > 1)
+		pkgconf_queue_preload(client, &initial_world);
+
 	PKGCONF_TRACE(client, "solving");
 	result = pkgconf_pkg_traverse(client, &initial_world, NULL, NULL, maxdepth, 0);
 	if (result != PKGCONF_PKG_ERRF_OK)
@@ -290,13 +325,14 @@ pkgconf_queue_verify(pkgconf_client_t *client, pkgconf_pkg_t *world, pkgconf_lis
 void
 pkgconf_solution_free(pkgconf_client_t *client, pkgconf_pkg_t *world)
 {
-	(void) client;
-
 	if (world->flags & PKGCONF_PKG_PROPF_VIRTUAL)
 	{
 		pkgconf_dependency_free(&world->required);
 		pkgconf_dependency_free(&world->requires_private);
 	}
+
+	/* packages of the solution which are over the cache limits can go now */
+	pkgconf_cache_trim(client);
 }
 
 /*
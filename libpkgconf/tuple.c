@@ -28,42 +28,283 @@
  * There are two sets of mappings: a ``pkgconf_pkg_t`` specific mapping, and a `global` mapping.
  * The `tuple` module provides convenience wrappers for managing the `global` mapping, which is
  * attached to a given client object.
+ *
+ * When a variable is substituted, its value is expanded once and the result is kept on the
+ * variable, so that further references reuse it.  The result depends on the other variables of
+ * the list and on the global variables, so it is not reused once a variable of the list has been
+ * added or deleted, or the global mapping has been modified through the wrappers below.  Both
+ * are tracked by serial numbers, which are bumped on every such change.
+ *
+ * A variable can also be added deferred, in which case its value is stored as written and only
+ * expanded the first time it is needed.  It expands to what it would have expanded to when it
+ * was added: only the variables defined before it are visible to it, and any variable waiting
+ * for expansion is expanded before a variable it may depend on gets redefined.
  */
 
+/* client flags which change how a value is expanded */
+#define PKGCONF_TUPLE_CLIENT_FLAGS (PKGCONF_PKG_PKGF_FDO_SYSROOT_RULES | PKGCONF_PKG_PKGF_PKGCONF1_SYSROOT_RULES)
+
 /*
- * !doc
- *
- * .. c:function:: void pkgconf_tuple_add_global(pkgconf_client_t *client, const char *key, const char *value)
- *
- *    Defines a global variable, replacing the previous declaration if one was set.
+ * Lists holding more than a few variables get an open-addressing index of their entries, hung
+ * off the list's lookup pointer, so that finding and overriding a variable does not walk the
+ * list.  The list itself still defines the order of the variables.  The index is only trusted
+ * while it accounts for every entry of the list, so lists which were filled without going
+ * through this module, such as compiled packages, get indexed on their first lookup.
+ */
+#define TUPLE_INDEX_MIN		8
+
+typedef struct {
+	uint32_t hash;
+	pkgconf_tuple_t *tuple;
+} tuple_slot_t;
+
+typedef struct {
+	size_t capacity;
+	size_t count;
+	tuple_slot_t slots[];
+} tuple_index_t;
+
+static inline uint32_t
+tuple_hash(const char *key, size_t len)
+{
+	uint32_t hash = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char) key[i];
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static tuple_index_t *
+tuple_index_get(const pkgconf_list_t *list)
+{
+	tuple_index_t *index = list->lookup;
+
+	if (index == NULL || index->count != list->length)
+		return NULL;
+
+	return index;
+}
+
+static inline bool
+tuple_key_equal(const pkgconf_tuple_t *tuple, const char *key, size_t len)
+{
+	return !strncmp(tuple->key, key, len) && tuple->key[len] == '\0';
+}
+
+static tuple_slot_t *
+tuple_index_slot(tuple_index_t *index, const char *key, size_t len, uint32_t hash)
+{
+	size_t mask = index->capacity - 1;
+	size_t i = hash & mask;
+
+	for (; index->slots[i].tuple != NULL; i = (i + 1) & mask)
+	{
+		if (index->slots[i].hash == hash && tuple_key_equal(index->slots[i].tuple, key, len))
+			break;
+	}
+
+	return &index->slots[i];
+}
+
+static void
+tuple_index_drop(pkgconf_list_t *list)
+{
+	free(list->lookup);
+	list->lookup = NULL;
+}
+
+/*
+ * tuple_index_build(list)
  *
- *    :param pkgconf_client_t* client: The pkgconf client object to modify.
- *    :param char* key: The key for the mapping (variable name).
- *    :param char* value: The value for the mapped entry.
- *    :return: nothing
+ * index every entry of a list, replacing any previous index.  if a key occurs more than once,
+ * the first occurrence is the one a lookup finds, and the index is left incomplete so that it
+ * is not trusted.
  */
-void
-pkgconf_tuple_add_global(pkgconf_client_t *client, const char *key, const char *value)
+static void
+tuple_index_build(pkgconf_list_t *list)
 {
-	pkgconf_tuple_add(client, &client->global_vars, key, value, false, 0);
+	size_t capacity = 16;
+	tuple_index_t *index;
+	pkgconf_node_t *node;
+
+	tuple_index_drop(list);
+
+	while (capacity < list->length * 2)
+		capacity *= 2;
+
+	index = calloc(1, sizeof(tuple_index_t) + capacity * sizeof(tuple_slot_t));
+	if (index == NULL)
+		return;
+
+	index->capacity = capacity;
+
+	PKGCONF_FOREACH_LIST_ENTRY(list->head, node)
+	{
+		pkgconf_tuple_t *tuple = node->data;
+		size_t len = strlen(tuple->key);
+		uint32_t hash = tuple_hash(tuple->key, len);
+		tuple_slot_t *slot = tuple_index_slot(index, tuple->key, len, hash);
+
+		if (slot->tuple != NULL)
+			continue;
+
+		slot->hash = hash;
+		slot->tuple = tuple;
+		index->count++;
+	}
+
+	list->lookup = index;
 }
 
+/* account for a variable which was just inserted into the list */
+static void
+tuple_index_insert(pkgconf_list_t *list, pkgconf_tuple_t *tuple)
+{
+	tuple_index_t *index = list->lookup;
+	tuple_slot_t *slot;
+	size_t len;
+	uint32_t hash;
+
+	if (list->length < TUPLE_INDEX_MIN)
+	{
+		tuple_index_drop(list);
+		return;
+	}
+
+	/* rebuild if the index went stale, or would be more than half full */
+	if (index == NULL || index->count + 1 != list->length || list->length * 2 > index->capacity)
+	{
+		tuple_index_build(list);
+		return;
+	}
+
+	len = strlen(tuple->key);
+	hash = tuple_hash(tuple->key, len);
+	slot = tuple_index_slot(index, tuple->key, len, hash);
+	if (slot->tuple != NULL)
+	{
+		/* a duplicate key, which leaves the index incomplete */
+		return;
+	}
+
+	slot->hash = hash;
+	slot->tuple = tuple;
+	index->count++;
+}
+
+/* account for a variable which is about to be deleted from the list */
+static void
+tuple_index_remove(pkgconf_list_t *list, pkgconf_tuple_t *tuple)
+{
+	tuple_index_t *index = tuple_index_get(list);
+	size_t len = strlen(tuple->key);
+	size_t mask, i, j;
+
+	if (index == NULL)
+	{
+		tuple_index_drop(list);
+		return;
+	}
+
+	mask = index->capacity - 1;
+	i = tuple_index_slot(index, tuple->key, len, tuple_hash(tuple->key, len)) - index->slots;
+	if (index->slots[i].tuple != tuple)
+	{
+		tuple_index_drop(list);
+		return;
+	}
+
+	/* shift later members of the probe sequence back, so that it stays unbroken */
+	for (j = (i + 1) & mask; index->slots[j].tuple != NULL; j = (j + 1) & mask)
+	{
+		size_t home = index->slots[j].hash & mask;
+
+		if (((j - home) & mask) >= ((j - i) & mask))
+		{
+			index->slots[i] = index->slots[j];
+			i = j;
+		}
+	}
+
+	index->slots[i].tuple = NULL;
+	index->count--;
+}
+
+/* find the variable named by the first `len` characters of `key` */
 static pkgconf_tuple_t *
-lookup_global_tuple(const pkgconf_client_t *client, const char *key)
+find_tuple(const pkgconf_list_t *list, const char *key, size_t len)
 {
+	tuple_index_t *index = tuple_index_get(list);
 	pkgconf_node_t *node;
 
-	PKGCONF_FOREACH_LIST_ENTRY(client->global_vars.head, node)
+	if (index != NULL)
+		return tuple_index_slot(index, key, len, tuple_hash(key, len))->tuple;
+
+	PKGCONF_FOREACH_LIST_ENTRY(list->head, node)
 	{
 		pkgconf_tuple_t *tuple = node->data;
 
-		if (!strcmp(tuple->key, key))
+		if (tuple_key_equal(tuple, key, len))
 			return tuple;
 	}
 
 	return NULL;
 }
 
+/* like find_tuple(), but index the list first if it is worth it */
+static pkgconf_tuple_t *
+lookup_tuple(pkgconf_list_t *list, const char *key, size_t len)
+{
+	if (list->length >= TUPLE_INDEX_MIN && tuple_index_get(list) == NULL)
+		tuple_index_build(list);
+
+	return find_tuple(list, key, len);
+}
+
+static void resolve_tuple(const pkgconf_client_t *client, pkgconf_list_t *vars, pkgconf_tuple_t *tuple);
+
+static pkgconf_tuple_t *
+lookup_global_tuple(const pkgconf_client_t *client, const char *key)
+{
+	return find_tuple(&client->global_vars, key, strlen(key));
+}
+
+/* the global mapping was modified: outdate expansions and refresh the client's path context */
+static void
+globals_changed(pkgconf_client_t *client)
+{
+	pkgconf_tuple_t *tuple = lookup_global_tuple(client, "pc_sysrootdir");
+
+	client->global_vars_serial++;
+
+	client->paths.global_sysroot_dir = tuple != NULL ? tuple->value : NULL;
+	client->paths.global_sysroot_len = tuple != NULL ? strlen(tuple->value) : 0;
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_tuple_add_global(pkgconf_client_t *client, const char *key, const char *value)
+ *
+ *    Defines a global variable, replacing the previous declaration if one was set.
+ *
+ *    :param pkgconf_client_t* client: The pkgconf client object to modify.
+ *    :param char* key: The key for the mapping (variable name).
+ *    :param char* value: The value for the mapped entry.
+ *    :return: nothing
+ */
+void
+pkgconf_tuple_add_global(pkgconf_client_t *client, const char *key, const char *value)
+{
+	pkgconf_tuple_add(client, &client->global_vars, key, value, false, 0);
+	globals_changed(client);
+}
+
 /*
  * !doc
  *
@@ -102,6 +343,7 @@ void
 pkgconf_tuple_free_global(pkgconf_client_t *client)
 {
 	pkgconf_tuple_free(&client->global_vars);
+	globals_changed(client);
 }
 
 /*
@@ -132,25 +374,35 @@ pkgconf_tuple_define_global(pkgconf_client_t *client, const char *kv)
 	if (tuple != NULL)
 		tuple->flags = PKGCONF_PKG_TUPLEF_OVERRIDE;
 
+	globals_changed(client);
+
 out:
 	free(workbuf);
 }
 
 static void
-pkgconf_tuple_find_delete(pkgconf_list_t *list, const char *key)
+forget_expansion(pkgconf_tuple_t *tuple)
 {
-	pkgconf_node_t *node, *next;
+	if (tuple->expanded != tuple->value)
+		free(tuple->expanded);
 
-	PKGCONF_FOREACH_LIST_ENTRY_SAFE(list->head, next, node)
-	{
-		pkgconf_tuple_t *tuple = node->data;
+	tuple->expanded = NULL;
+}
 
-		if (!strcmp(tuple->key, key))
-		{
-			pkgconf_tuple_free_entry(tuple, list);
-			return;
-		}
-	}
+/* the variables of a list changed, so expansions made against it may be stale */
+static inline void
+vars_changed(pkgconf_list_t *list)
+{
+	list->serial++;
+}
+
+static void
+pkgconf_tuple_find_delete(pkgconf_list_t *list, const char *key)
+{
+	pkgconf_tuple_t *tuple = lookup_tuple(list, key, strlen(key));
+
+	if (tuple != NULL)
+		pkgconf_tuple_free_entry(tuple, list);
 }
 
 static char *
@@ -161,7 +413,7 @@ dequote(const char *value)
 	const char *i;
 	char quote = 0;
 
-	if (*value == '\'' || *value == '"')
+	if (*value != '\0' && strchr("'\"", *value) != NULL)
 		quote = *value;
 
 	for (i = value; *i != '\0'; i++)
@@ -179,44 +431,98 @@ dequote(const char *value)
 }
 
 static const char *
-find_sysroot(const pkgconf_client_t *client, pkgconf_list_t *vars)
+find_sysroot(const pkgconf_client_t *client, pkgconf_list_t *vars, size_t *len)
 {
+	const pkgconf_path_context_t *paths = &client->paths;
 	const char *sysroot_dir;
 
 	sysroot_dir = pkgconf_tuple_find(client, vars, "pc_sysrootdir");
 	if (sysroot_dir == NULL)
-		sysroot_dir = client->sysroot_dir;
+	{
+		*len = paths->sysroot_len;
+		return paths->sysroot_dir;
+	}
+
+	/* usually the global variable, whose length is known */
+	*len = sysroot_dir == paths->global_sysroot_dir ? paths->global_sysroot_len : strlen(sysroot_dir);
 
 	return sysroot_dir;
 }
 
+/*
+ * should_rewrite_sysroot(client, vars, buf, len, flags, skip)
+ *
+ * check whether the expanded path `buf` of `len` bytes carries the sysroot twice, and if so,
+ * how long the leading one is.
+ */
 static bool
-should_rewrite_sysroot(const pkgconf_client_t *client, pkgconf_list_t *vars, const char *buf, unsigned int flags)
+should_rewrite_sysroot(const pkgconf_client_t *client, pkgconf_list_t *vars, const char *buf, size_t len, unsigned int flags, size_t *skip)
 {
 	const char *sysroot_dir;
+	size_t sysroot_len;
 
 	if (flags & PKGCONF_PKG_PROPF_UNINSTALLED && !(client->flags & PKGCONF_PKG_PKGF_FDO_SYSROOT_RULES))
 		return false;
 
-	sysroot_dir = find_sysroot(client, vars);
-	if (sysroot_dir == NULL)
+	if (*buf != '/')
 		return false;
 
-	if (*buf != '/')
+	sysroot_dir = find_sysroot(client, vars, &sysroot_len);
+	if (sysroot_dir == NULL)
 		return false;
 
-	if (!strcmp(sysroot_dir, "/"))
+	if (sysroot_len == 1 && *sysroot_dir == '/')
 		return false;
 
-	if (strlen(buf) <= strlen(sysroot_dir))
+	if (len <= sysroot_len)
 		return false;
 
-	if (strstr(buf + strlen(sysroot_dir), sysroot_dir) == NULL)
+	if (strstr(buf + sysroot_len, sysroot_dir) == NULL)
 		return false;
 
+	*skip = sysroot_len;
 	return true;
 }
 
+static pkgconf_tuple_t *
+define_tuple(const pkgconf_client_t *client, pkgconf_list_t *list, const char *key, const char *value, bool parse, bool defer, unsigned int flags)
+{
+	char *dequote_value;
+	pkgconf_tuple_t *tuple = calloc(1, sizeof(pkgconf_tuple_t));
+
+	/* a deferred variable may refer to the one being replaced, so expand it while it can */
+	if (lookup_tuple(list, key, strlen(key)) != NULL)
+	{
+		pkgconf_tuple_resolve(client, list);
+		pkgconf_tuple_find_delete(list, key);
+	}
+
+	dequote_value = dequote(value);
+
+	tuple->key = strdup(key);
+	tuple->order = list->head != NULL ? ((pkgconf_tuple_t *) list->head->data)->order + 1 : 1;
+	if (defer)
+	{
+		tuple->value = strdup(dequote_value);
+		tuple->flags = PKGCONF_PKG_TUPLEF_DEFERRED;
+		tuple->deferred_flags = flags;
+	}
+	else if (parse)
+		tuple->value = pkgconf_tuple_parse(client, list, dequote_value, flags);
+	else
+		tuple->value = strdup(dequote_value);
+
+	PKGCONF_TRACE(client, "adding tuple to @%p: %s => %s (parsed? %d, deferred? %d)", list, key, tuple->value, parse, defer);
+
+	vars_changed(list);
+	pkgconf_node_insert(&tuple->iter, tuple, list);
+	tuple_index_insert(list, tuple);
+
+	free(dequote_value);
+
+	return tuple;
+}
+
 /*
  * !doc
  *
@@ -235,26 +541,30 @@ should_rewrite_sysroot(const pkgconf_client_t *client, pkgconf_list_t *vars, con
 pkgconf_tuple_t *
 pkgconf_tuple_add(const pkgconf_client_t *client, pkgconf_list_t *list, const char *key, const char *value, bool parse, unsigned int flags)
 {
-	char *dequote_value;
-	pkgconf_tuple_t *tuple = calloc(1, sizeof(pkgconf_tuple_t));
-
-	pkgconf_tuple_find_delete(list, key);
-
-	dequote_value = dequote(value);
-
-	tuple->key = strdup(key);
-	if (parse)
-		tuple->value = pkgconf_tuple_parse(client, list, dequote_value, flags);
-	else
-		tuple->value = strdup(dequote_value);
-
-	PKGCONF_TRACE(client, "adding tuple to @%p: %s => %s (parsed? %d)", list, key, tuple->value, parse);
-
-	pkgconf_node_insert(&tuple->iter, tuple, list);
-
-	free(dequote_value);
+	return define_tuple(client, list, key, value, parse, false, flags);
+}
 
-	return tuple;
+/*
+ * !doc
+ *
+ * .. c:function:: pkgconf_tuple_t *pkgconf_tuple_add_deferred(const pkgconf_client_t *client, pkgconf_list_t *list, const char *key, const char *value, unsigned int flags)
+ *
+ *    Define a variable whose value is parsed for variable substitution the first time it is
+ *    looked up or referenced, rather than right away.  The result is the same as if the value had
+ *    been parsed by :c:func:`pkgconf_tuple_add`.
+ *
+ *    :param pkgconf_client_t* client: The pkgconf client object to access.
+ *    :param pkgconf_list_t* list: The variable list to add the new variable to.
+ *    :param char* key: The name of the variable being added.
+ *    :param char* value: The value of the variable being added.
+ *    :param uint flags: Any flags to consider while parsing the value.
+ *    :return: a variable object
+ *    :rtype: pkgconf_tuple_t *
+ */
+pkgconf_tuple_t *
+pkgconf_tuple_add_deferred(const pkgconf_client_t *client, pkgconf_list_t *list, const char *key, const char *value, unsigned int flags)
+{
+	return define_tuple(client, list, key, value, true, true, flags);
 }
 
 /*
@@ -273,19 +583,16 @@ pkgconf_tuple_add(const pkgconf_client_t *client, pkgconf_list_t *list, const ch
 char *
 pkgconf_tuple_find(const pkgconf_client_t *client, pkgconf_list_t *list, const char *key)
 {
-	pkgconf_node_t *node;
-	pkgconf_tuple_t *global_tuple;
+	pkgconf_tuple_t *tuple, *global_tuple;
 
 	global_tuple = lookup_global_tuple(client, key);
 	if (global_tuple != NULL && global_tuple->flags & PKGCONF_PKG_TUPLEF_OVERRIDE)
 		return global_tuple->value;
 
-	PKGCONF_FOREACH_LIST_ENTRY(list->head, node)
+	if ((tuple = lookup_tuple(list, key, strlen(key))) != NULL)
 	{
-		pkgconf_tuple_t *tuple = node->data;
-
-		if (!strcmp(tuple->key, key))
-			return tuple->value;
+		resolve_tuple(client, list, tuple);
+		return tuple->value;
 	}
 
 	if (global_tuple != NULL)
@@ -295,111 +602,222 @@ pkgconf_tuple_find(const pkgconf_client_t *client, pkgconf_list_t *list, const c
 }
 
 /*
- * !doc
- *
- * .. c:function:: char *pkgconf_tuple_parse(const pkgconf_client_t *client, pkgconf_list_t *vars, const char *value, unsigned int flags)
+ * Expansion appends to a single heap buffer shared by every level of nesting, so that expanding a
+ * variable costs no stack beyond a small frame per level.  The output of a top-level expansion is
+ * limited to TUPLE_EXPANSION_MAX bytes and nesting to TUPLE_EXPANSION_DEPTH levels, which bounds
+ * the work done on hostile input such as the billion laughs.
+ */
+#define TUPLE_EXPANSION_MAX	(1024 * 1024)
+#define TUPLE_EXPANSION_DEPTH	64
+
+typedef struct {
+	char *buf;
+	size_t len;
+	size_t size;
+	unsigned int depth;
+
+	/* output stopped at the size limit */
+	bool truncated;
+
+	/* a reference was dropped at the depth limit */
+	bool incomplete;
+
+	/* if set, only variables ordered before this one are visible */
+	size_t before;
+} tuple_expansion_t;
+
+static bool
+expansion_reserve(tuple_expansion_t *exp, size_t len)
+{
+	size_t size = exp->size ? exp->size : 256;
+	char *buf;
+
+	if (exp->len + len < exp->size)
+		return true;
+
+	while (size <= exp->len + len)
+		size *= 2;
+
+	if ((buf = realloc(exp->buf, size)) == NULL)
+		return false;
+
+	exp->buf = buf;
+	exp->size = size;
+
+	return true;
+}
+
+static void
+expansion_append(const pkgconf_client_t *client, tuple_expansion_t *exp, const char *str, size_t len)
+{
+	if (exp->truncated)
+		return;
+
+	if (exp->len + len > TUPLE_EXPANSION_MAX)
+	{
+		pkgconf_warn(client, "warning: truncating very long variable to 1MB\n");
+
+		len = TUPLE_EXPANSION_MAX - exp->len;
+		exp->truncated = true;
+	}
+
+	if (!expansion_reserve(exp, len))
+	{
+		exp->truncated = true;
+		return;
+	}
+
+	memcpy(exp->buf + exp->len, str, len);
+	exp->len += len;
+	exp->buf[exp->len] = '\0';
+}
+
+/* take the result of a top-level expansion */
+static char *
+expansion_finish(tuple_expansion_t *exp)
+{
+	char *buf;
+
+	if (exp->buf == NULL)
+		return strdup("");
+
+	/* give back the slack of the expansion buffer, the result may be kept for long */
+	if ((buf = realloc(exp->buf, exp->len + 1)) == NULL)
+		return exp->buf;
+
+	return buf;
+}
+
+static void expand_value(const pkgconf_client_t *client, pkgconf_list_t *vars, const char *value, unsigned int flags, tuple_expansion_t *exp);
+
+/*
+ * expand_tuple(client, vars, tuple, flags, exp)
  *
- *    Parse an expression for variable substitution.
+ * append the expansion of a variable of `vars`, reusing the previous one if nothing it depends
+ * on has changed since, and otherwise remembering it on the variable.
+ */
+static void
+expand_tuple(const pkgconf_client_t *client, pkgconf_list_t *vars, pkgconf_tuple_t *tuple, unsigned int flags, tuple_expansion_t *exp)
+{
+	unsigned int client_flags = client->flags & PKGCONF_TUPLE_CLIENT_FLAGS;
+	size_t start = exp->len;
+	char *expanded;
+
+	/* a bounded expansion sees fewer variables than the remembered one did */
+	if (exp->before == 0 && tuple->expanded != NULL && tuple->expanded_flags == flags &&
+	    tuple->expanded_client_flags == client_flags && tuple->expanded_serial == client->global_vars_serial &&
+	    tuple->expanded_vars_serial == vars->serial)
+	{
+		expansion_append(client, exp, tuple->expanded, strlen(tuple->expanded));
+		return;
+	}
+
+	if (exp->depth >= TUPLE_EXPANSION_DEPTH)
+	{
+		if (!exp->incomplete)
+			pkgconf_warn(client, "warning: variable nesting too deep, not expanding ${%s}\n", tuple->key);
+
+		exp->incomplete = true;
+		return;
+	}
+
+	forget_expansion(tuple);
+
+	exp->depth++;
+	expand_value(client, vars, tuple->value, flags, exp);
+	exp->depth--;
+
+	/* a partial expansion depends on where it happened, so it must not be reused */
+	if (exp->truncated || exp->incomplete || exp->before != 0)
+		return;
+
+	/* most values are stored expanded already, share them instead of keeping a copy */
+	if (!strcmp(exp->buf + start, tuple->value))
+		expanded = tuple->value;
+	else if ((expanded = strdup(exp->buf + start)) == NULL)
+		return;
+
+	tuple->expanded = expanded;
+	tuple->expanded_flags = flags;
+	tuple->expanded_client_flags = client_flags;
+	tuple->expanded_serial = client->global_vars_serial;
+	tuple->expanded_vars_serial = vars->serial;
+}
+
+static void
+expand_reference(const pkgconf_client_t *client, pkgconf_list_t *vars, const char *name, size_t len, unsigned int flags, tuple_expansion_t *exp)
+{
+	pkgconf_tuple_t *tuple;
+
+	PKGCONF_TRACE(client, "lookup tuple %.*s", (int) len, name);
+
+	if ((tuple = find_tuple(&client->global_vars, name, len)) != NULL)
+	{
+		expansion_append(client, exp, tuple->value, strlen(tuple->value));
+		return;
+	}
+
+	if ((tuple = lookup_tuple(vars, name, len)) == NULL)
+		return;
+
+	/* the variable was defined after the deferred one being expanded */
+	if (exp->before != 0 && tuple->order >= exp->before)
+		return;
+
+	resolve_tuple(client, vars, tuple);
+	expand_tuple(client, vars, tuple, flags, exp);
+}
+
+/*
+ * expand_value(client, vars, value, flags, exp)
  *
- *    :param pkgconf_client_t* client: The pkgconf client object to access.
- *    :param pkgconf_list_t* list: The variable list to search for variables (along side the global variable list).
- *    :param char* value: The ``key=value`` string to parse.
- *    :param uint flags: Any flags to consider while parsing.
- *    :return: the variable data with any variables substituted
- *    :rtype: char *
+ * append `value` with its variables substituted.
  */
-char *
-pkgconf_tuple_parse(const pkgconf_client_t *client, pkgconf_list_t *vars, const char *value, unsigned int flags)
+static void
+expand_value(const pkgconf_client_t *client, pkgconf_list_t *vars, const char *value, unsigned int flags, tuple_expansion_t *exp)
 {
-	char buf[PKGCONF_BUFSIZE];
-	const char *ptr;
-	char *bptr = buf;
+	const pkgconf_path_context_t *paths = &client->paths;
+	size_t start = exp->len, skip;
+	const char *ptr = value;
+
+	/* the buffer always holds a terminated string, even if nothing gets appended */
+	if (!expansion_reserve(exp, 0))
+	{
+		exp->truncated = true;
+		return;
+	}
+
+	exp->buf[exp->len] = '\0';
 
 	if (!(client->flags & PKGCONF_PKG_PKGF_FDO_SYSROOT_RULES) &&
 		(!(flags & PKGCONF_PKG_PROPF_UNINSTALLED) || (client->flags & PKGCONF_PKG_PKGF_PKGCONF1_SYSROOT_RULES)))
 	{
-		if (*value == '/' && client->sysroot_dir != NULL && strncmp(value, client->sysroot_dir, strlen(client->sysroot_dir)))
-			bptr += pkgconf_strlcpy(buf, client->sysroot_dir, sizeof buf);
+		if (*value == '/' && paths->sysroot_dir != NULL && strncmp(value, paths->sysroot_dir, paths->sysroot_len))
+			expansion_append(client, exp, paths->sysroot_dir, paths->sysroot_len);
 	}
 
-	for (ptr = value; *ptr != '\0' && bptr - buf < PKGCONF_BUFSIZE; ptr++)
+	while (*ptr != '\0' && !exp->truncated)
 	{
-		if (*ptr != '$' || (*ptr == '$' && *(ptr + 1) != '{'))
-			*bptr++ = *ptr;
-		else if (*(ptr + 1) == '{')
-		{
-			char varname[PKGCONF_ITEM_SIZE];
-			char *vend = varname + PKGCONF_ITEM_SIZE - 1;
-			char *vptr = varname;
-			const char *pptr;
-			char *kv, *parsekv;
-
-			*vptr = '\0';
-
-			for (pptr = ptr + 2; *pptr != '\0'; pptr++)
-			{
-				if (*pptr != '}')
-				{
-					if (vptr < vend)
-						*vptr++ = *pptr;
-					else
-					{
-						*vptr = '\0';
-						break;
-					}
-				}
-				else
-				{
-					*vptr = '\0';
-					break;
-				}
-			}
-
-			PKGCONF_TRACE(client, "lookup tuple %s", varname);
-
-			size_t remain = PKGCONF_BUFSIZE - (bptr - buf);
-			ptr += (pptr - ptr);
-			kv = pkgconf_tuple_find_global(client, varname);
-			if (kv != NULL)
-			{
-				size_t nlen = pkgconf_strlcpy(bptr, kv, remain);
-				if (nlen > remain)
-				{
-					pkgconf_warn(client, "warning: truncating very long variable to 64KB\n");
-
-					bptr = buf + (PKGCONF_BUFSIZE - 1);
-					break;
-				}
-
-				bptr += nlen;
-			}
-			else
-			{
-				kv = pkgconf_tuple_find(client, vars, varname);
-
-				if (kv != NULL)
-				{
-					size_t nlen;
-
-					parsekv = pkgconf_tuple_parse(client, vars, kv, flags);
-					nlen = pkgconf_strlcpy(bptr, parsekv, remain);
-					free(parsekv);
-
-					if (nlen > remain)
-					{
-						pkgconf_warn(client, "warning: truncating very long variable to 64KB\n");
-
-						bptr = buf + (PKGCONF_BUFSIZE - 1);
-						break;
-					}
-
-					bptr += nlen;
-				}
-			}
-		}
-	}
+		const char *run = ptr, *name;
+
+		while (*ptr != '\0' && (*ptr != '$' || *(ptr + 1) != '{'))
+			ptr++;
 
-	*bptr = '\0';
+		expansion_append(client, exp, run, ptr - run);
+
+		if (*ptr == '\0')
+			break;
+
+		/* an unterminated reference extends to the end of the value */
+		name = ptr + 2;
+		for (ptr = name; *ptr != '\0' && *ptr != '}'; ptr++)
+			;
+
+		expand_reference(client, vars, name, ptr - name, flags, exp);
+
+		if (*ptr == '}')
+			ptr++;
+	}
 
 	/*
 	 * Sigh.  Somebody actually attempted to use freedesktop.org pkg-config's broken sysroot support,
@@ -418,18 +836,98 @@ pkgconf_tuple_parse(const pkgconf_client_t *client, pkgconf_list_t *vars, const
 	 *
 	 * New in 1.9: Only attempt to rewrite the sysroot if we are not processing an uninstalled package.
 	 */
-	if (should_rewrite_sysroot(client, vars, buf, flags))
+	if (should_rewrite_sysroot(client, vars, exp->buf + start, exp->len - start, flags, &skip))
 	{
-		char cleanpath[PKGCONF_ITEM_SIZE];
-		const char *sysroot_dir = find_sysroot(client, vars);
+		/* relocate in place, within the same bounds a path buffer would impose */
+		memmove(exp->buf + start, exp->buf + start + skip, exp->len - start - skip + 1);
+		exp->len -= skip;
 
-		pkgconf_strlcpy(cleanpath, buf + strlen(sysroot_dir), sizeof cleanpath);
-		pkgconf_path_relocate(cleanpath, sizeof cleanpath);
+		if (!expansion_reserve(exp, PKGCONF_ITEM_SIZE))
+			return;
 
-		return strdup(cleanpath);
+		if (exp->len - start >= PKGCONF_ITEM_SIZE)
+			exp->buf[start + PKGCONF_ITEM_SIZE - 1] = '\0';
+
+		pkgconf_path_relocate(exp->buf + start, PKGCONF_ITEM_SIZE);
+		exp->len = start + strlen(exp->buf + start);
 	}
+}
 
-	return strdup(buf);
+/*
+ * !doc
+ *
+ * .. c:function:: char *pkgconf_tuple_parse(const pkgconf_client_t *client, pkgconf_list_t *vars, const char *value, unsigned int flags)
+ *
+ *    Parse an expression for variable substitution.
+ *
+ *    :param pkgconf_client_t* client: The pkgconf client object to access.
+ *    :param pkgconf_list_t* list: The variable list to search for variables (along side the global variable list).
+ *    :param char* value: The ``key=value`` string to parse.
+ *    :param uint flags: Any flags to consider while parsing.
+ *    :return: the variable data with any variables substituted
+ *    :rtype: char *
+ */
+char *
+pkgconf_tuple_parse(const pkgconf_client_t *client, pkgconf_list_t *vars, const char *value, unsigned int flags)
+{
+	tuple_expansion_t exp = { 0 };
+
+	expand_value(client, vars, value, flags, &exp);
+
+	return expansion_finish(&exp);
+}
+
+/* expand a deferred variable against the variables defined before it */
+static void
+resolve_tuple(const pkgconf_client_t *client, pkgconf_list_t *vars, pkgconf_tuple_t *tuple)
+{
+	tuple_expansion_t exp = { 0 };
+
+	if (!(tuple->flags & PKGCONF_PKG_TUPLEF_DEFERRED))
+		return;
+
+	/* cleared first, as the expansion may look the variable up again */
+	tuple->flags &= ~PKGCONF_PKG_TUPLEF_DEFERRED;
+
+	exp.before = tuple->order;
+	expand_value(client, vars, tuple->value, tuple->deferred_flags, &exp);
+
+	free(tuple->value);
+	tuple->value = expansion_finish(&exp);
+
+	PKGCONF_TRACE(client, "expanded deferred tuple %s => %s", tuple->key, tuple->value);
+}
+
+/*
+ * !doc
+ *
+ * .. c:function:: void pkgconf_tuple_resolve(const pkgconf_client_t *client, pkgconf_list_t *list)
+ *
+ *    Parse the values of any variables of a list which were added with
+ *    :c:func:`pkgconf_tuple_add_deferred` and not parsed yet, so that the list can be read
+ *    directly.
+ *
+ *    :param pkgconf_client_t* client: The pkgconf client object to access.
+ *    :param pkgconf_list_t* list: The variable list to resolve.
+ *    :return: nothing
+ */
+void
+pkgconf_tuple_resolve(const pkgconf_client_t *client, pkgconf_list_t *list)
+{
+	pkgconf_node_t *node;
+
+	PKGCONF_FOREACH_LIST_ENTRY(list->head, node)
+		resolve_tuple(client, list, node->data);
+}
+
+static void
+free_tuple(pkgconf_tuple_t *tuple)
+{
+	forget_expansion(tuple);
+
+	free(tuple->key);
+	free(tuple->value);
+	free(tuple);
 }
 
 /*
@@ -447,11 +945,11 @@ pkgconf_tuple_parse(const pkgconf_client_t *client, pkgconf_list_t *vars, const
 void
 pkgconf_tuple_free_entry(pkgconf_tuple_t *tuple, pkgconf_list_t *list)
 {
+	tuple_index_remove(list, tuple);
 	pkgconf_node_delete(&tuple->iter, list);
+	vars_changed(list);
 
-	free(tuple->key);
-	free(tuple->value);
-	free(tuple);
+	free_tuple(tuple);
 }
 
 /*
@@ -470,7 +968,8 @@ pkgconf_tuple_free(pkgconf_list_t *list)
 	pkgconf_node_t *node, *next;
 
 	PKGCONF_FOREACH_LIST_ENTRY_SAFE(list->head, next, node)
-		pkgconf_tuple_free_entry(node->data, list);
+		free_tuple(node->data);
 
+	tuple_index_drop(list);
 	pkgconf_list_zero(list);
 }
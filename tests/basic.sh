@@ -26,6 +26,7 @@ tests_init \
 	exists_cflags_env \
 	uninstalled_bad \
 	uninstalled \
+	uninstalled_direct \
 	libs_intermediary \
 	libs_circular1 \
 	libs_circular2 \
@@ -44,7 +45,17 @@ tests_init \
 	relocatable \
 	single_depth_selectors \
 	print_variables_env \
-	variable_env
+	variable_env \
+	many_variables \
+	many_fragments \
+	merged_fragments \
+	rebuild_index \
+	rebuild_index_edited \
+	rebuild_index_order \
+	scan_workers \
+	preload_workers \
+	missing_repeated \
+	stats
 
 noargs_body()
 {
@@ -172,6 +183,14 @@ uninstalled_body()
 		pkgconf --uninstalled 'omg'
 }
 
+uninstalled_direct_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/nonexistent:${selfdir}/lib1"
+	atf_check \
+		-o inline:"1.2.3\n" \
+		pkgconf --modversion 'omg-uninstalled'
+}
+
 exists_version_bad2_body()
 {
 	export PKG_CONFIG_PATH="${selfdir}/lib1"
@@ -381,3 +400,129 @@ variable_env_body()
 		-o inline:"FOO_INCLUDEDIR='/test/include'\n" \
 		pkgconf --with-path=${selfdir}/lib1 --env=FOO --variable=includedir foo
 }
+
+many_variables_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		-o inline:"moduledir\nlibdir\nplugindir\nlocalstatedir\nsysconfdir\nmandir\ndocdir\ndatadir\nincludedir\nexec_prefix\nprefix\npcfiledir\n" \
+		pkgconf --print-variables many-variables
+	atf_check \
+		-o inline:"/test/lib/plugins\n" \
+		pkgconf --variable=plugindir many-variables
+	atf_check \
+		-o inline:"-L/test/lib64 -lmany\n" \
+		pkgconf --libs many-variables
+}
+
+many_fragments_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		-o inline:"-L/test/lib -lc -ld -le -lf -lg -framework Bar -lh -li -lj -lk -la -framework Foo -ll -lm -lb -ln\n" \
+		pkgconf --libs many-fragments
+	atf_check \
+		-o inline:"-L/test/lib -lc -ld -le -lf -lg -framework Bar -lh -li -lj -lk -la -framework Foo -ll -lm -lb -ln -lm -lz -lm -framework Bar\n" \
+		pkgconf --static --libs many-fragments
+	atf_check \
+		-o inline:"-I/test/include -DB -DC -DD -DE -DF -DG -DH -DI -DJ -DK -DA -isystem /sys -DL\n" \
+		pkgconf --cflags many-fragments
+}
+
+merged_fragments_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		-o inline:"-la1 -la2 -la3 -la4 -la5 -la6 -la7 -la8 -la9 -la10 -la11 -la12 -la13 -la14 -la15 -la16 -la17 -lx -ly -framework Bar -lz -framework Foo\n" \
+		pkgconf --libs merged-fragments
+}
+
+rebuild_index_body()
+{
+	mkdir idx
+	cp "${selfdir}/lib1/foo.pc" "${selfdir}/lib1/omg-uninstalled.pc" idx/
+	export PKG_CONFIG_LIBDIR="$(pwd)/idx"
+	atf_check \
+		pkgconf --rebuild-index
+	atf_check \
+		-o match:"^foo	foo.pc	[0-9]+	1.2.3	foo = 1.2.3$" \
+		cat idx/.pkgconf-index
+	atf_check \
+		test -f idx/foo.pcc
+	atf_check \
+		-o inline:"-L/test/lib -lfoo\n" \
+		pkgconf --libs foo
+	atf_check \
+		-o inline:"-fPIC -I/sysroot/test/include/foo -L/sysroot/test/lib -lfoo\n" \
+		env PKG_CONFIG_SYSROOT_DIR=/sysroot pkgconf --cflags --libs foo
+	atf_check \
+		pkgconf --uninstalled omg
+	atf_check \
+		-o match:"^foo +foo - A testing pkg-config file$" \
+		pkgconf --list-all
+}
+
+rebuild_index_edited_body()
+{
+	mkdir idx
+	cp "${selfdir}/lib1/foo.pc" idx/
+	export PKG_CONFIG_LIBDIR="$(pwd)/idx"
+	atf_check \
+		pkgconf --rebuild-index
+	# rewrite the file in place, so that only its modification time changes
+	sed 's/^Version: 1.2.3$/Version: 1.2.4/' idx/foo.pc >foo.pc
+	cat foo.pc >idx/foo.pc
+	atf_check \
+		-o inline:"1.2.4\n" \
+		pkgconf --modversion foo
+}
+
+rebuild_index_order_body()
+{
+	mkdir idx
+	cp "${selfdir}"/lib1/*.pc idx/
+	export PKG_CONFIG_LIBDIR="$(pwd)/idx"
+	pkgconf --list-all >unindexed 2>/dev/null
+	atf_check \
+		pkgconf --rebuild-index
+	atf_check \
+		-e ignore \
+		-o file:unindexed \
+		pkgconf --list-all
+}
+
+scan_workers_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	pkgconf --list-all >serial 2>/dev/null
+	atf_check \
+		-e ignore \
+		-o file:serial \
+		env PKG_CONFIG_SCAN_WORKERS=4 pkgconf --list-all
+}
+
+preload_workers_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		-o inline:"-L/test/lib -lbar -lbaz -L/test/lib -lzee -lfoo\n" \
+		env PKG_CONFIG_SCAN_WORKERS=4 pkgconf --static --libs foo bar baz
+}
+
+missing_repeated_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		-s exit:1 \
+		-e inline:"Package 'nonexistant' not found\nPackage 'nonexistant' not found\n" \
+		pkgconf --exists --print-errors --short-errors nonexistant foo 'nonexistant >= 1'
+}
+
+stats_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		-o inline:"-L/test/lib -lfoo\n" \
+		-e match:"^files_parsed=1$" \
+		pkgconf --stats --libs foo
+}
@@ -6,6 +6,7 @@ tests_init \
 	comments \
 	comments_in_fields \
 	dos \
+	dos_continuation \
 	no_trailing_newline \
 	argv_parse \
 	bad_option \
@@ -24,11 +25,17 @@ tests_init \
 	fragment_escaping_1 \
 	fragment_escaping_2 \
 	fragment_escaping_3 \
+	fragment_escaping_4 \
 	fragment_quoting \
 	fragment_quoting_2 \
 	fragment_quoting_3 \
 	fragment_quoting_5 \
 	fragment_quoting_7 \
+	fragment_quoting_8 \
+	fragment_whitespace \
+	fragment_empty_arg \
+	fragment_unbalanced \
+	fragment_long_define \
 	fragment_comment \
 	msvc_fragment_quoting \
 	msvc_fragment_render_cflags \
@@ -61,6 +68,14 @@ dos_body()
 		pkgconf --libs dos-lineendings
 }
 
+dos_continuation_body()
+{
+	printf 'foo=bar\\\r\n\tbaz\r\nName: crlf\r\nDescription: x\r\nVersion: 1\r\n' > crlf.pc
+	atf_check \
+		-o inline:"barbaz\n" \
+		pkgconf --with-path=. --variable=foo crlf
+}
+
 no_trailing_newline_body()
 {
 	export PKG_CONFIG_PATH="${selfdir}/lib1"
@@ -247,6 +262,55 @@ fragment_escaping_3_body()
 		pkgconf --with-path="${selfdir}/lib1" --cflags fragment-escaping-3
 }
 
+fragment_escaping_4_body()
+{
+	atf_check \
+		-o inline:'-DA=a\\ b -DB=c\\"d -DC=e\\\\f -DD=g\\\\h -DE=i\\"j\n' \
+		pkgconf --with-path="${selfdir}/lib1" --cflags fragment-escaping-4
+}
+
+fragment_quoting_8_body()
+{
+	atf_check \
+		-o inline:'-DA=x\\\\y -DB=\\\\ -DC\n' \
+		pkgconf --with-path="${selfdir}/lib1" --cflags fragment-quoting-8
+}
+
+fragment_whitespace_body()
+{
+	atf_check \
+		-o inline:"-DA -DB -DC -DD\n" \
+		pkgconf --with-path="${selfdir}/lib1" --cflags fragment-whitespace
+}
+
+fragment_empty_arg_body()
+{
+	atf_check \
+		-o inline:"-la -lb -lc\n" \
+		pkgconf --with-path="${selfdir}/lib1" --libs fragment-empty-arg
+}
+
+fragment_unbalanced_body()
+{
+	atf_check \
+		-o inline:"\n" \
+		pkgconf --with-path="${selfdir}/lib1" --cflags fragment-unbalanced
+	atf_check \
+		-o inline:"\n" \
+		pkgconf --with-path="${selfdir}/lib1" --libs fragment-unbalanced
+}
+
+fragment_long_define_body()
+{
+	# a fragment longer than PKGCONF_ITEM_SIZE is cut off, whether or not it is a path
+	pkgconf --with-path="${selfdir}/lib1" --cflags fragment-long-define >stdout
+	atf_check \
+		-o match:"^-DLONG=x+$" \
+		cat stdout
+	atf_check \
+		test "$(wc -c <stdout)" -lt 6000
+}
+
 fragment_quoting_7a_body()
 {
 	set -x
@@ -10,7 +10,10 @@ tests_init \
 	quux \
 	moo \
 	meow \
-	indirect_dependency_node
+	indirect_dependency_node \
+	indexed \
+	indexed_edited \
+	multiple_providers
 
 simple_body()
 {
@@ -308,3 +311,43 @@ indirect_dependency_node_body()
 		-e ignore \
 		pkgconf --with-path="${selfdir}/lib1" --modversion 'provides-test-meow = 1.3.0'
 }
+
+indexed_body()
+{
+	mkdir idx
+	cp "${selfdir}/lib1/provides.pc" "${selfdir}/lib1/provides-request-simple.pc" "${selfdir}/lib1/foo.pc" idx/
+	export PKG_CONFIG_LIBDIR="$(pwd)/idx"
+	atf_check \
+		pkgconf --rebuild-index
+	atf_check \
+		-o inline:"-lfoo\n" \
+		pkgconf --libs provides-request-simple
+	atf_check \
+		-o inline:"-lfoo\n" \
+		pkgconf --libs 'provides-test-bar > 1.1.1'
+}
+
+indexed_edited_body()
+{
+	mkdir idx
+	cp "${selfdir}/lib1/foo.pc" idx/
+	export PKG_CONFIG_LIBDIR="$(pwd)/idx"
+	atf_check \
+		pkgconf --rebuild-index
+	echo "Provides: provides-test-edited = 2.0" >>idx/foo.pc
+	atf_check \
+		-o inline:"1.2.3\n" \
+		pkgconf --modversion provides-test-edited
+}
+
+multiple_providers_body()
+{
+	export PKG_CONFIG_PATH="${selfdir}/lib1"
+	atf_check \
+		-o inline:"-lfoo\n" \
+		pkgconf --libs provides-test-foo 'provides-test-baz >= 1.1.0' 'provides-test-moo <= 1.2.0'
+	atf_check \
+		-s exit:1 \
+		-e ignore \
+		pkgconf --libs provides-test-foo 'provides-test-meow = 1.3.0'
+}
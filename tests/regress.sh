@@ -41,6 +41,9 @@ tests_init \
 	empty_tuple \
 	solver_requires_private_debounce \
 	billion_laughs \
+	long_variable \
+	recursive_variable \
+	redefined_variable \
 	define_prefix_child_prefix_1 \
 	define_prefix_child_prefix_1_env
 
@@ -281,10 +284,29 @@ solver_requires_private_debounce_body()
 
 billion_laughs_body()
 {
-	atf_check -o inline:"warning: truncating very long variable to 64KB\nwarning: truncating very long variable to 64KB\nwarning: truncating very long variable to 64KB\nwarning: truncating very long variable to 64KB\nwarning: truncating very long variable to 64KB\n" \
+	atf_check -o inline:"warning: truncating very long variable to 1MB\nwarning: truncating very long variable to 1MB\nwarning: truncating very long variable to 1MB\nwarning: truncating very long variable to 1MB\n" \
 		pkgconf --with-path="${selfdir}/lib1" --validate billion-laughs
 }
 
+recursive_variable_body()
+{
+	atf_check -o inline:"-I/include\n" \
+		pkgconf --with-path="${selfdir}/lib1" --define-variable='loop=${self}' --cflags recursive-variable
+}
+
+redefined_variable_body()
+{
+	atf_check -o inline:"one/:two:x\n" \
+		pkgconf --with-path="${selfdir}/lib1" --variable=e redefined-variable
+}
+
+long_variable_body()
+{
+	pkgconf --with-path="${selfdir}/lib1" --variable=d long-variable >out
+	atf_check -o inline:"100001\n" \
+		sh -c 'wc -c <out | tr -d " "'
+}
+
 modversion_common_prefix_body()
 {
 	atf_check -o inline:"foo: 1.2.3\nfoobar: 3.2.1\n" \